@@ -6,11 +6,28 @@
 // output.txt.
 
 #include <algorithm>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <iterator>
 #include <stdio.h>
 #include <time.h>
+#include <utility>
+
+#define INSERTION_CUTOFF 16
+#define NINTHER_THRESHOLD 128
+#define PDQ_INSERTION_CUTOFF 24
+#define PDQ_PARTIAL_LIMIT 8
+#define PDQ_BLOCK_SIZE 64
+#define RADIX_BITS 11 // three passes cover 32-bit keys
+#define RADIX_PASSES 3
+#define RADIX_MASK ((1u << RADIX_BITS) - 1)
+#define FLAG_BITS 8
+#define FLAG_MASK ((1u << FLAG_BITS) - 1)
+#define FLAG_CUTOFF 64
+#define COUNTING_RANGE_RATIO 4 // count when max - min < 4 * len
 
 /* pointer to function type defnitions */
 // compare function
@@ -69,154 +86,801 @@ inline static void write_output(const int *arr, const int len, FILE *fout,
 }
 
 /**
- * swap - swap two elements
- * ---------------------------------------------------------------
- *  @a: pointer to the first element
- *  @b: pointer to the second element
- *  @width: size of the 2 elements
+ * CompLess - a less-than predicate that calls a CompFunc, for the kernels
+ * sorting data that is not compared by cmp_func
  */
-inline static void swap(void *a, void *b, size_t width)
-{
-    char temp[width];
-    memcpy(temp, a, width);
-    memcpy(a, b, width);
-    memcpy(b, temp, width);
-}
+template <typename T> struct CompLess {
+    CompFunc compar;
+    bool operator()(const T &a, const T &b) const
+    {
+        return compar(&a, &b) < 0;
+    }
+};
 
 /**
- * sorting algorithms
+ * sorting kernels
  * ---------------------------------------------------------------
  *  @base: pointer to the array
  *  @len: length of the array
- *  @width: size of each element
- *  @compar: compare function
+ *  @less: less-than predicate, inlined when it is a functor like std::less
  *
- *  Note: only annotated once since every sorting algorithm has the same
- *      parameters
+ *  Note: each kernel is a functor so it can be handed to sort_adapter as a
+ *      template argument
  */
-inline static void selection_sort(void *base, size_t len, size_t width,
-                                  CompFunc compar)
-{
-    for (size_t i = 0; i < len; i++) {
-        size_t min = i;
-        for (size_t j = i + 1; j < len; j++) {
-            char *cur_ele = (char *)base + j * width;
-            char *min_ele = (char *)base + min * width;
-            if (compar(cur_ele, min_ele) < 0) {
-                min = j;
+struct SelectionSort {
+    template <typename T, typename Compare>
+    void operator()(T *base, size_t len, Compare less) const
+    {
+        for (size_t i = 0; i < len; i++) {
+            size_t min = i;
+            for (size_t j = i + 1; j < len; j++) {
+                if (less(base[j], base[min]))
+                    min = j;
             }
-        }
-        if (i != min) {
-            char *cur_ele = (char *)base + i * width;
-            char *min_ele = (char *)base + min * width;
-            swap(cur_ele, min_ele, width);
+            if (i != min)
+                std::swap(base[i], base[min]);
         }
     }
-}
+};
 
-/** heapify - create a min heap
+/** heapify - sift a node down a max heap
  * ---------------------------------------------------------------
  * @base: pointer to the array
  * @len: length of the array
- * @width: size of each element
- * @compar: compare function
+ * @less: less-than predicate
  * @i: index of the root node
  */
-inline static void heapify(void *base, size_t len, size_t width,
-                           CompFunc compar, size_t i)
+template <typename T, typename Compare>
+inline static void heapify(T *base, size_t len, Compare less, size_t i)
 {
-    size_t largest = i;
-    size_t left = 2 * i + 1;
-    size_t right = 2 * i + 2;
-
-    // the left node is smaller
-    if (left < len) {
-        char *left_ele = (char *)base + left * width;
-        char *largest_ele = (char *)base + largest * width;
-        if (compar(left_ele, largest_ele) > 0) {
-            largest = left;
+    // move the larger children up until the root fits, instead of swapping
+    T root = base[i];
+    for (size_t child; (child = 2 * i + 1) < len; i = child) {
+        if (child + 1 < len && less(base[child], base[child + 1]))
+            child++;
+        if (!less(root, base[child]))
+            break;
+        base[i] = base[child];
+    }
+    base[i] = root;
+}
+
+struct HeapSort {
+    template <typename T, typename Compare>
+    void operator()(T *base, size_t len, Compare less) const
+    {
+        if (len < 2)
+            return;
+
+        for (size_t i = len / 2; i-- > 0;)
+            heapify(base, len, less, i);
+
+        for (size_t i = len - 1; i != 0; i--) {
+            std::swap(base[0], base[i]);
+            heapify(base, i, less, 0);
         }
     }
+};
+
+/**
+ * partition - partition the array around its last element
+ * ---------------------------------------------------------------
+ *  @base: pointer to the array
+ *  @len: length of the array
+ *  @less: less-than predicate
+ *
+ *  Return: the index of the pivot
+ */
+template <typename T, typename Compare>
+inline static size_t partition(T *base, size_t len, Compare less)
+{
+    size_t end = len - 1;
+    size_t partition_idx = 0;
 
-    // if the right node is smaller
-    if (right < len) {
-        char *right_ele = (char *)base + right * width;
-        char *largest_ele = (char *)base + largest * width;
-        if (compar(right_ele, largest_ele) > 0) {
-            largest = right;
+    for (size_t i = 0; i < end; i++) {
+        // if current element is not larger than pivot
+        // swap it with the element at the partition index (since the element at
+        // the partition index is larger than the pivot)
+        if (!less(base[end], base[i])) {
+            std::swap(base[i], base[partition_idx]);
+            partition_idx++;
         }
     }
 
-    // swap if any children is smaller than the original one
-    if (largest != i) {
-        char *largest_ele = (char *)base + largest * width;
-        char *i_ele = (char *)base + i * width;
-        swap(i_ele, largest_ele, width);
-        heapify(base, len, width, compar, largest);
+    std::swap(base[end], base[partition_idx]);
+    return partition_idx;
+}
+
+struct QuickSort {
+    template <typename T, typename Compare>
+    void operator()(T *base, size_t len, Compare less) const
+    {
+        if (len <= 1)
+            return;
+
+        // the pivot is in place, leave it out of both halves
+        size_t partition_idx = partition(base, len, less);
+        (*this)(base, partition_idx, less);
+        (*this)(base + partition_idx + 1, len - partition_idx - 1, less);
+    }
+};
+
+/**
+ * insertion_sort - sort a short array in place, used below INSERTION_CUTOFF
+ * ---------------------------------------------------------------
+ *  @base: pointer to the array
+ *  @len: length of the array
+ *  @less: less-than predicate
+ */
+template <typename T, typename Compare>
+inline static void insertion_sort(T *base, size_t len, Compare less)
+{
+    for (size_t i = 1; i < len; i++) {
+        T cur = base[i];
+        size_t j = i;
+        for (; j > 0 && less(cur, base[j - 1]); j--)
+            base[j] = base[j - 1];
+        base[j] = cur;
     }
 }
 
-inline static void heap_sort(void *base, size_t len, size_t width,
-                             CompFunc compar)
+/**
+ * sort3 - order three elements so the median ends up at index b
+ * ---------------------------------------------------------------
+ *  @base: pointer to the array
+ *  @a: index of the first element
+ *  @b: index of the second element
+ *  @c: index of the third element
+ *  @less: less-than predicate
+ */
+template <typename T, typename Compare>
+inline static void sort3(T *base, size_t a, size_t b, size_t c, Compare less)
 {
-    if (len < 2)
-        return;
+    if (less(base[b], base[a]))
+        std::swap(base[a], base[b]);
+    if (less(base[c], base[b])) {
+        std::swap(base[b], base[c]);
+        if (less(base[b], base[a]))
+            std::swap(base[a], base[b]);
+    }
+}
+
+/**
+ * choose_pivot - move a median-of-3 pivot to the front, or Tukey's ninther
+ *  (the median of three medians) once the array is longer than
+ *  NINTHER_THRESHOLD
+ * ---------------------------------------------------------------
+ *  @base: pointer to the array
+ *  @len: length of the array
+ *  @less: less-than predicate
+ */
+template <typename T, typename Compare>
+inline static void choose_pivot(T *base, size_t len, Compare less)
+{
+    size_t mid = len / 2;
+    if (len > NINTHER_THRESHOLD) {
+        size_t step = len / 8;
+        sort3(base, 0, step, 2 * step, less);
+        sort3(base, mid - step, mid, mid + step, less);
+        sort3(base, len - 1 - 2 * step, len - 1 - step, len - 1, less);
+        sort3(base, step, mid, len - 1 - step, less);
+    } else {
+        sort3(base, 0, mid, len - 1, less);
+    }
+    std::swap(base[0], base[mid]);
+}
 
-    for (int i = (int)(len / 2 - 1); i >= 0; i--)
-        heapify(base, len, width, compar, i);
+/**
+ * partition3 - partition the array around its first element into the
+ *  elements smaller than, equal to and larger than it (Dutch national flag)
+ * ---------------------------------------------------------------
+ *  @base: pointer to the array
+ *  @len: length of the array
+ *  @less: less-than predicate
+ *  @lt: set to the index of the first element equal to the pivot
+ *  @gt: set to the index of the first element larger than the pivot
+ */
+template <typename T, typename Compare>
+inline static void partition3(T *base, size_t len, Compare less, size_t *lt,
+                              size_t *gt)
+{
+    // [0, lo) < pivot, [lo, i) == pivot, [hi, len) > pivot
+    T pivot = base[0];
+    size_t lo = 0, i = 1, hi = len;
+    while (i < hi) {
+        if (less(base[i], pivot))
+            std::swap(base[lo++], base[i++]);
+        else if (less(pivot, base[i]))
+            std::swap(base[i], base[--hi]);
+        else
+            i++;
+    }
+    *lt = lo;
+    *gt = hi;
+}
 
-    for (size_t i = len - 1; i != 0; i--) {
-        swap(base, (char *)base + i * width, width);
-        heapify(base, i, width, compar, 0);
+struct IntroSort {
+    template <typename T, typename Compare>
+    void operator()(T *base, size_t len, Compare less) const
+    {
+        // give up on quick sort after 2 * log2(len) levels
+        size_t depth = 0;
+        for (size_t n = len; n > 1; n >>= 1)
+            depth += 2;
+        sort(base, len, less, depth);
+    }
+
+    template <typename T, typename Compare>
+    static void sort(T *base, size_t len, Compare less, size_t depth)
+    {
+        while (len > INSERTION_CUTOFF) {
+            if (depth-- == 0) {
+                HeapSort()(base, len, less);
+                return;
+            }
+
+            choose_pivot(base, len, less);
+            size_t lt, gt;
+            partition3(base, len, less, &lt, &gt);
+
+            // recurse into the smaller side and loop on the larger one, so
+            // the stack stays within log2(len) frames
+            if (lt < len - gt) {
+                sort(base, lt, less, depth);
+                base += gt;
+                len -= gt;
+            } else {
+                sort(base + gt, len - gt, less, depth);
+                len = lt;
+            }
+        }
+        insertion_sort(base, len, less);
+    }
+};
+
+/**
+ * unguarded_insertion_sort - insertion sort for a slice that is not the
+ *  leftmost one, base[-1] is not larger than any of its elements and stops
+ *  every scan, so the bound check is left out
+ * ---------------------------------------------------------------
+ *  @base: pointer to the array
+ *  @len: length of the array
+ *  @less: less-than predicate
+ */
+template <typename T, typename Compare>
+inline static void unguarded_insertion_sort(T *base, size_t len, Compare less)
+{
+    for (size_t i = 1; i < len; i++) {
+        T cur = base[i];
+        T *hole = base + i;
+        for (; less(cur, hole[-1]); hole--)
+            *hole = hole[-1];
+        *hole = cur;
     }
 }
 
 /**
- * partition - partition the array
+ * partial_insertion_sort - insertion sort that gives up once more than
+ *  PDQ_PARTIAL_LIMIT elements have been moved
  * ---------------------------------------------------------------
  *  @base: pointer to the array
  *  @len: length of the array
- *  @width: size of each element
- *  @compar: compare function
- *  @i: index of the root node
+ *  @less: less-than predicate
+ *
+ *  Return: whether the array is sorted
+ */
+template <typename T, typename Compare>
+inline static bool partial_insertion_sort(T *base, size_t len, Compare less)
+{
+    size_t moved = 0;
+    for (size_t i = 1; i < len; i++) {
+        if (!less(base[i], base[i - 1]))
+            continue;
+
+        T cur = base[i];
+        size_t j = i;
+        for (; j > 0 && less(cur, base[j - 1]); j--)
+            base[j] = base[j - 1];
+        base[j] = cur;
+        moved += i - j;
+        if (moved > PDQ_PARTIAL_LIMIT)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * swap_offsets - move the misplaced elements recorded in two offset blocks
+ *  to the other side
+ * ---------------------------------------------------------------
+ *  @left: the element offsets_l is relative to
+ *  @right: the element offsets_r counts back from
+ *  @offsets_l: offsets of the elements that belong on the right
+ *  @offsets_r: offsets of the elements that belong on the left
+ *  @num: number of pairs to exchange
+ *  @use_swaps: exchange pairwise, which keeps descending input linear
+ */
+template <typename T>
+inline static void swap_offsets(T *left, T *right,
+                                const unsigned char *offsets_l,
+                                const unsigned char *offsets_r, size_t num,
+                                bool use_swaps)
+{
+    if (use_swaps) {
+        for (size_t i = 0; i < num; i++)
+            std::swap(left[offsets_l[i]], *(right - offsets_r[i]));
+    } else if (num > 0) {
+        // a cyclic permutation costs one move per element instead of three
+        T *l = left + offsets_l[0];
+        T *r = right - offsets_r[0];
+        T tmp = *l;
+        *l = *r;
+        for (size_t i = 1; i < num; i++) {
+            l = left + offsets_l[i];
+            *r = *l;
+            r = right - offsets_r[i];
+            *l = *r;
+        }
+        *r = tmp;
+    }
+}
+
+/**
+ * block_partition - partition the array around its first element, the
+ *  elements equal to the pivot go right. The misplaced elements are found in
+ *  blocks of PDQ_BLOCK_SIZE, recording their offsets without branching on
+ *  the comparison (BlockQuicksort), and then exchanged in one go.
+ * ---------------------------------------------------------------
+ *  @base: pointer to the array, base[0] is the pivot
+ *  @len: length of the array, at least 3 with a median-of-3 pivot
+ *  @less: less-than predicate
+ *  @partitioned: set to whether no element had to be moved
  *
  *  Return: the index of the pivot
  */
-inline static int partition(void *base, size_t len, size_t width,
-                            CompFunc compar)
+template <typename T, typename Compare>
+inline static size_t block_partition(T *base, size_t len, Compare less,
+                                     bool *partitioned)
 {
-    size_t end = len - 1;
-    char *pivot = (char *)base + end * width;
-    size_t partition_idx = 0;
+    T pivot = base[0];
+    T *first = base;
+    T *last = base + len;
 
-    for (size_t i = 0; i < end; i++) {
-        char *cur = (char *)base + i * width;
+    // the median of 3 guarantees an element not smaller than the pivot
+    while (less(*++first, pivot))
+        ;
+    // the search from the right is only guarded if nothing precedes first
+    if (first - 1 == base) {
+        while (first < last && !less(*--last, pivot))
+            ;
+    } else {
+        while (!less(*--last, pivot))
+            ;
+    }
 
-        // if current element is smaller than pivot
-        // swap it with the element at the partition index (since the element at
-        // the partition index is larger than the pivot)
-        if (compar(cur, pivot) <= 0) {
-            char *swp_chk_ele = (char *)base + partition_idx * width;
-            swap(cur, swp_chk_ele, width);
-            partition_idx++;
+    *partitioned = first >= last;
+    if (!*partitioned) {
+        std::swap(*first, *last);
+        ++first;
+
+        alignas(64) unsigned char offsets_l[PDQ_BLOCK_SIZE];
+        alignas(64) unsigned char offsets_r[PDQ_BLOCK_SIZE];
+        T *left = first;
+        T *right = last;
+        size_t num_l = 0, num_r = 0, start_l = 0, start_r = 0;
+
+        while (first < last) {
+            // refill the blocks that are empty, splitting what is left of
+            // the unknown elements between them
+            size_t unknown = (size_t)(last - first);
+            size_t left_split =
+                num_l == 0 ? (num_r == 0 ? unknown / 2 : unknown) : 0;
+            size_t right_split = num_r == 0 ? unknown - left_split : 0;
+
+            left_split = std::min(left_split, (size_t)PDQ_BLOCK_SIZE);
+            for (size_t i = 0; i < left_split; i++) {
+                offsets_l[num_l] = (unsigned char)i;
+                num_l += !less(*first, pivot);
+                ++first;
+            }
+            right_split = std::min(right_split, (size_t)PDQ_BLOCK_SIZE);
+            for (size_t i = 0; i < right_split;) {
+                offsets_r[num_r] = (unsigned char)++i;
+                num_r += less(*--last, pivot);
+            }
+
+            size_t num = std::min(num_l, num_r);
+            swap_offsets(left, right, offsets_l + start_l, offsets_r + start_r,
+                         num, num_l == num_r);
+            num_l -= num;
+            num_r -= num;
+            start_l += num;
+            start_r += num;
+
+            if (num_l == 0) {
+                start_l = 0;
+                left = first;
+            }
+            if (num_r == 0) {
+                start_r = 0;
+                right = last;
+            }
+        }
+
+        // one block may still hold misplaced elements, swap them to the
+        // boundary
+        if (num_l) {
+            while (num_l--)
+                std::swap(left[offsets_l[start_l + num_l]], *--last);
+            first = last;
+        }
+        if (num_r) {
+            while (num_r--)
+                std::swap(*(right - offsets_r[start_r + num_r]), *first++);
+            last = first;
         }
     }
 
-    char *swp_chk_ele = (char *)base + partition_idx * width;
-    swap(pivot, swp_chk_ele, width);
-    return partition_idx;
+    // put the pivot in place
+    T *pivot_pos = first - 1;
+    base[0] = *pivot_pos;
+    *pivot_pos = pivot;
+    return (size_t)(pivot_pos - base);
 }
 
-inline static void quick_sort(void *base, size_t len, size_t width,
-                              CompFunc compar)
+/**
+ * partition_left - partition the array around its first element, the
+ *  elements equal to the pivot go left. Used when the pivot equals the
+ *  element before the slice, so that everything left of it is equal.
+ * ---------------------------------------------------------------
+ *  @base: pointer to the array, base[0] is the pivot
+ *  @len: length of the array
+ *  @less: less-than predicate
+ *
+ *  Return: the index of the pivot
+ */
+template <typename T, typename Compare>
+inline static size_t partition_left(T *base, size_t len, Compare less)
+{
+    T pivot = base[0];
+    T *first = base;
+    T *last = base + len;
+
+    while (less(pivot, *--last))
+        ;
+    if (last + 1 == base + len) {
+        while (first < last && !less(pivot, *++first))
+            ;
+    } else {
+        while (!less(pivot, *++first))
+            ;
+    }
+
+    while (first < last) {
+        std::swap(*first, *last);
+        while (less(pivot, *--last))
+            ;
+        while (!less(pivot, *++first))
+            ;
+    }
+
+    base[0] = *last;
+    *last = pivot;
+    return (size_t)(last - base);
+}
+
+struct PdqSort {
+    template <typename T, typename Compare>
+    void operator()(T *base, size_t len, Compare less) const
+    {
+        // after log2(len) badly unbalanced partitions, heap sort the rest
+        size_t bad_allowed = 0;
+        for (size_t n = len; n > 1; n >>= 1)
+            bad_allowed++;
+        sort(base, len, less, bad_allowed, true);
+    }
+
+    template <typename T, typename Compare>
+    static void sort(T *base, size_t len, Compare less, size_t bad_allowed,
+                     bool leftmost)
+    {
+        while (true) {
+            if (len < PDQ_INSERTION_CUTOFF) {
+                if (leftmost)
+                    insertion_sort(base, len, less);
+                else
+                    unguarded_insertion_sort(base, len, less);
+                return;
+            }
+
+            // the pivot goes to base[0]
+            size_t mid = len / 2;
+            if (len > NINTHER_THRESHOLD) {
+                sort3(base, 0, mid, len - 1, less);
+                sort3(base, 1, mid - 1, len - 2, less);
+                sort3(base, 2, mid + 1, len - 3, less);
+                sort3(base, mid - 1, mid, mid + 1, less);
+                std::swap(base[0], base[mid]);
+            } else {
+                sort3(base, mid, 0, len - 1, less);
+            }
+
+            // nothing in the slice is smaller than base[-1], so a pivot equal
+            // to it is the smallest element: put its duplicates on the left,
+            // where they are already sorted
+            if (!leftmost && !less(base[-1], base[0])) {
+                size_t pivot = partition_left(base, len, less) + 1;
+                base += pivot;
+                len -= pivot;
+                continue;
+            }
+
+            bool partitioned;
+            size_t pivot = block_partition(base, len, less, &partitioned);
+            size_t l_len = pivot;
+            size_t r_len = len - pivot - 1;
+            T *right = base + pivot + 1;
+
+            if (l_len < len / 8 || r_len < len / 8) {
+                if (--bad_allowed == 0) {
+                    HeapSort()(base, len, less);
+                    return;
+                }
+
+                // shuffle a few elements on both sides to break up the
+                // pattern that led to the bad pivot
+                if (l_len >= PDQ_INSERTION_CUTOFF) {
+                    size_t q = l_len / 4;
+                    std::swap(base[0], base[q]);
+                    std::swap(base[l_len - 1], base[l_len - q]);
+                    if (l_len > NINTHER_THRESHOLD) {
+                        std::swap(base[1], base[q + 1]);
+                        std::swap(base[2], base[q + 2]);
+                        std::swap(base[l_len - 2], base[l_len - q - 1]);
+                        std::swap(base[l_len - 3], base[l_len - q - 2]);
+                    }
+                }
+                if (r_len >= PDQ_INSERTION_CUTOFF) {
+                    size_t q = r_len / 4;
+                    std::swap(right[0], right[q]);
+                    std::swap(right[r_len - 1], right[r_len - q]);
+                    if (r_len > NINTHER_THRESHOLD) {
+                        std::swap(right[1], right[q + 1]);
+                        std::swap(right[2], right[q + 2]);
+                        std::swap(right[r_len - 2], right[r_len - q - 1]);
+                        std::swap(right[r_len - 3], right[r_len - q - 2]);
+                    }
+                }
+            } else if (partitioned &&
+                       partial_insertion_sort(base, l_len, less) &&
+                       partial_insertion_sort(right, r_len, less)) {
+                // a balanced split that moved nothing: the input was likely
+                // sorted already, and a few insertions have proven it
+                return;
+            }
+
+            // recurse into the left side and loop on the right one
+            sort(base, l_len, less, bad_allowed, leftmost);
+            base = right;
+            len = r_len;
+            leftmost = false;
+        }
+    }
+};
+
+/**
+ * sort_adapter - run a sorting kernel through the SortFunc interface
+ * ---------------------------------------------------------------
+ *  @base: pointer to the array
+ *  @len: length of the array
+ *  @width: size of each element
+ *  @compar: compare function
+ *
+ *  Note: the kernels are instantiated for int, the only type the benchmark
+ *      sorts, and cmp_func becomes an inlined std::less. Any other width
+ *      goes to qsort.
+ */
+template <typename Kernel>
+static void sort_adapter(void *base, size_t len, size_t width, CompFunc compar)
 {
-    if (len <= 1)
+    if (width != sizeof(int)) {
+        qsort(base, len, width, compar);
         return;
+    }
 
-    int partition_idx = partition(base, len, width, compar);
-    quick_sort(base, partition_idx, width, compar);
-    quick_sort((char *)base + partition_idx * width, len - partition_idx, width,
-               compar);
+    int *arr = (int *)base;
+    if (compar == cmp_func)
+        Kernel()(arr, len, std::less<int>());
+    else
+        Kernel()(arr, len, CompLess<int>{compar});
+}
+
+/**
+ * radix_key - map an int to an unsigned key in the same order, so negative
+ *  numbers sort before positive ones
+ * ---------------------------------------------------------------
+ *  @x: the int
+ *
+ *  Return: the key
+ */
+inline static uint32_t radix_key(int x)
+{
+    return (uint32_t)x ^ 0x80000000u;
+}
+
+/**
+ * radix sorting kernels, for int keys in ascending order
+ * ---------------------------------------------------------------
+ *  @base: pointer to the array
+ *  @len: length of the array
+ */
+struct LsdRadixSort {
+    void operator()(int *base, size_t len) const
+    {
+        if (len < 2)
+            return;
+
+        // count the digits of every pass in one read of the input
+        size_t counts[RADIX_PASSES][1 << RADIX_BITS] = {};
+        for (size_t i = 0; i < len; i++) {
+            uint32_t key = radix_key(base[i]);
+            for (int pass = 0; pass < RADIX_PASSES; pass++)
+                counts[pass][(key >> (pass * RADIX_BITS)) & RADIX_MASK]++;
+        }
+
+        int *buf = (int *)malloc(len * sizeof(int));
+        if (!buf) {
+            PdqSort()(base, len, std::less<int>());
+            return;
+        }
+
+        int *src = base, *dst = buf;
+        for (int pass = 0; pass < RADIX_PASSES; pass++) {
+            size_t *count = counts[pass];
+            int shift = pass * RADIX_BITS;
+
+            // every key has the same digit, the pass would only copy
+            if (count[(radix_key(src[0]) >> shift) & RADIX_MASK] == len)
+                continue;
+
+            size_t sum = 0;
+            for (size_t digit = 0; digit < (1 << RADIX_BITS); digit++) {
+                size_t num = count[digit];
+                count[digit] = sum;
+                sum += num;
+            }
+            for (size_t i = 0; i < len; i++) {
+                int x = src[i];
+                dst[count[(radix_key(x) >> shift) & RADIX_MASK]++] = x;
+            }
+            std::swap(src, dst);
+        }
+
+        if (src != base)
+            memcpy(base, src, len * sizeof(int));
+        free(buf);
+    }
+};
+
+struct AmericanFlagSort {
+    void operator()(int *base, size_t len) const
+    {
+        sort(base, len, 32 - FLAG_BITS);
+    }
+
+    /**
+     * sort - distribute the array in place by one byte of the keys, then
+     *  sort every bucket by the next byte
+     * ---------------------------------------------------------------
+     *  @base: pointer to the array
+     *  @len: length of the array
+     *  @shift: position of the byte
+     */
+    static void sort(int *base, size_t len, int shift)
+    {
+        const size_t buckets = 1 << FLAG_BITS;
+        while (len > FLAG_CUTOFF) {
+            size_t count[buckets] = {0};
+            for (size_t i = 0; i < len; i++)
+                count[(radix_key(base[i]) >> shift) & FLAG_MASK]++;
+
+            // all keys share this byte, go straight to the next one
+            size_t first = (radix_key(base[0]) >> shift) & FLAG_MASK;
+            if (count[first] == len) {
+                if (shift == 0)
+                    return;
+                shift -= FLAG_BITS;
+                continue;
+            }
+
+            // next[b] is the next unplaced slot of bucket b, end[b] its end
+            size_t next[buckets], end[buckets];
+            size_t sum = 0;
+            for (size_t b = 0; b < buckets; b++) {
+                next[b] = sum;
+                sum += count[b];
+                end[b] = sum;
+            }
+
+            // follow each displaced key to its bucket, swapping out the key
+            // that was there, until one belonging here turns up
+            for (size_t b = 0; b < buckets; b++) {
+                while (next[b] < end[b]) {
+                    int x = base[next[b]];
+                    size_t digit = (radix_key(x) >> shift) & FLAG_MASK;
+                    while (digit != b) {
+                        std::swap(x, base[next[digit]++]);
+                        digit = (radix_key(x) >> shift) & FLAG_MASK;
+                    }
+                    base[next[b]++] = x;
+                }
+            }
+
+            if (shift == 0)
+                return;
+            for (size_t b = 0, start = 0; b < buckets; start = end[b++]) {
+                if (end[b] - start > 1)
+                    sort(base + start, end[b] - start, shift - FLAG_BITS);
+            }
+            return;
+        }
+        insertion_sort(base, len, std::less<int>());
+    }
+};
+
+struct CountingSort {
+    void operator()(int *base, size_t len) const
+    {
+        if (len < 2)
+            return;
+
+        int min = base[0], max = base[0];
+        for (size_t i = 1; i < len; i++) {
+            min = std::min(min, base[i]);
+            max = std::max(max, base[i]);
+        }
+
+        // counting only pays off while the range is about as small as the
+        // array, larger ranges go to the LSD kernel. 32-bit counts keep the
+        // table half the size, so it is used up to UINT32_MAX keys.
+        size_t range = (size_t)((uint32_t)max - (uint32_t)min) + 1;
+        uint32_t *count = NULL;
+        if (range <= len * COUNTING_RANGE_RATIO && len <= UINT32_MAX)
+            count = (uint32_t *)calloc(range, sizeof(uint32_t));
+        if (!count) {
+            LsdRadixSort()(base, len);
+            return;
+        }
+
+        for (size_t i = 0; i < len; i++)
+            count[(uint32_t)base[i] - (uint32_t)min]++;
+        int *out = base;
+        for (size_t v = 0; v < range; v++)
+            out = std::fill_n(out, count[v], (int)((uint32_t)min + v));
+        free(count);
+    }
+};
+
+/**
+ * radix_adapter - run a radix kernel through the SortFunc interface
+ * ---------------------------------------------------------------
+ *  @base: pointer to the array
+ *  @len: length of the array
+ *  @width: size of each element
+ *  @compar: compare function
+ *
+ *  Note: the digits only give the order of cmp_func on ints, anything else
+ *      is handed to the pdq sort kernel
+ */
+template <typename Kernel>
+static void radix_adapter(void *base, size_t len, size_t width,
+                          CompFunc compar)
+{
+    if (width != sizeof(int) || compar != cmp_func) {
+        sort_adapter<PdqSort>(base, len, width, compar);
+        return;
+    }
+    Kernel()((int *)base, len);
 }
 
 /**
@@ -258,29 +922,33 @@ inline static void perform_csorting(const char *input_file, int i,
     // read input
     int len;
     fscanf(fin, "%d", &len);
-    int arr[len];
+    int *arr = (int *)malloc(len * sizeof(int));
     get_input(arr, len, fin);
 
     // execute and output
     time_sorting(func, arr, len);
     write_output(arr, len, fout, func.name);
+    free(arr);
 }
 
 /**
  * perform_cppsorting - perform cpp sorting algorithm
  * ---------------------------------------------------------------
  *  @input_file: input file
+ *  @i: index of the output file, after the c sortings
  */
-inline static void perform_cppsorting(const char *input_file)
+inline static void perform_cppsorting(const char *input_file, int i)
 {
     const char *func_name = "sort (cpp algorithm lib)";
+    char out_filename[20];
+    snprintf(out_filename, 20, "output%c.txt", i + 65);
     FILE *fin = fopen(input_file, "r");
-    FILE *fout = fopen("outputE.txt", "w");
+    FILE *fout = fopen(out_filename, "w");
 
     // read input
     int len;
     fscanf(fin, "%d", &len);
-    int arr[len];
+    int *arr = (int *)malloc(len * sizeof(int));
     get_input(arr, len, fin);
 
     // time execution
@@ -295,6 +963,7 @@ inline static void perform_cppsorting(const char *input_file)
     printf("%s: %f sec\n", func_name, cpu_time);
 
     write_output(arr, len, fout, func_name);
+    free(arr);
 }
 
 int main(int argc, char **argv)
@@ -311,19 +980,39 @@ int main(int argc, char **argv)
     FuncWithName sort_funcs[] = {
         FuncWithName{
             .name = "Selection Sort",
-            .func = &selection_sort,
+            .func = &sort_adapter<SelectionSort>,
         },
         FuncWithName{
             .name = "Heap Sort",
-            .func = &heap_sort,
+            .func = &sort_adapter<HeapSort>,
         },
         FuncWithName{
             .name = "Quick Sort",
-            .func = &quick_sort,
+            .func = &sort_adapter<QuickSort>,
+        },
+        FuncWithName{
+            .name = "Intro Sort",
+            .func = &sort_adapter<IntroSort>,
+        },
+        FuncWithName{
+            .name = "Pdq Sort",
+            .func = &sort_adapter<PdqSort>,
+        },
+        FuncWithName{
+            .name = "LSD Radix Sort",
+            .func = &radix_adapter<LsdRadixSort>,
+        },
+        FuncWithName{
+            .name = "American Flag Sort",
+            .func = &radix_adapter<AmericanFlagSort>,
+        },
+        FuncWithName{
+            .name = "Counting Sort",
+            .func = &radix_adapter<CountingSort>,
         },
         FuncWithName{
             .name = "qsort (c library)",
-            .func = &heap_sort,
+            .func = &qsort,
         },
     };
 
@@ -334,5 +1023,5 @@ int main(int argc, char **argv)
     }
 
     // c++ sort
-    perform_cppsorting(argv[1]);
+    perform_cppsorting(argv[1], (int)std::size(sort_funcs));
 }
@@ -0,0 +1,63 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#define CACHE_KEY_LEN 64
+#define CACHE_DIR_LEN 128
+#define CACHE_PATH_LEN (CACHE_DIR_LEN + CACHE_KEY_LEN + 2)
+
+typedef struct CacheEntry CacheEntry;
+struct CacheEntry {
+    char key[CACHE_KEY_LEN + 1];
+    uint64_t size;
+    CacheEntry *prev; // the neighbours in use order, most recent first
+    CacheEntry *next;
+    CacheEntry *chain; // the next entry in the same bucket
+};
+
+typedef struct Cache Cache;
+struct Cache {
+    char dir[CACHE_DIR_LEN]; // where the cached files live
+    uint64_t size;           // the bytes of every cached file
+    uint64_t limit;          // the bytes kept before evicting
+    CacheEntry **buckets;
+    size_t bucket_num;
+    CacheEntry *head; // the most recently used entry
+    CacheEntry *tail; // the next entry to evict
+    pthread_mutex_t lock;
+
+    /**
+     * Hard link the cached file for a key to a path
+     * @param self The cache
+     * @param key The key, CACHE_KEY_LEN hex digits
+     * @param path Where the file should appear, it must not exist
+     * @return 0 on a hit, -1 on a miss
+     */
+    int (*fetch)(Cache *self, const char *key, const char *path);
+
+    /**
+     * Keep a file for a key, evicting the least recently used files while
+     * the cache is over its limit
+     * @param self The cache
+     * @param key The key, CACHE_KEY_LEN hex digits
+     * @param path The file, which is hard linked and stays where it is
+     */
+    void (*store)(Cache *self, const char *key, const char *path);
+
+    /**
+     * Free the cache, the files stay on disk for the next run
+     * @param self The cache
+     */
+    void (*destroy)(Cache **self);
+};
+
+/**
+ * new_cache - open the cache in a directory, picking up the files a previous
+ * run left there.
+ * @param dir The directory, created if it does not exist
+ * @param limit The bytes kept before evicting
+ * @return: A pointer to the new cache.
+ */
+extern Cache *new_cache(const char *dir, uint64_t limit);
+#endif
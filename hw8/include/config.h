@@ -1,8 +1,10 @@
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
+#include "logger.h"
 #include <stdbool.h>
 #include <stdlib.h>
 #define autofree_config __attribute__((cleanup(free_config)))
+#define MAX_JOBS 256
 
 enum MODE { COMPRESS, DECOMPRESS };
 
@@ -12,6 +14,9 @@ struct Config {
     const char *output_file;
     enum MODE mode;
     bool using_server;
+    bool text_format;
+    size_t jobs;
+    enum LOG_LEVEL log_level;
 };
 
 extern Config *new_config(const int argc, const char **argv);
@@ -0,0 +1,92 @@
+#ifndef _JOB_H_
+#define _JOB_H_
+#include "pool.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+enum JOB_STATE { JOB_QUEUED, JOB_RUNNING, JOB_DONE, JOB_FAILED };
+
+/**
+ * The work of a job, run on a job worker
+ * @param arg The argument given when the job was submitted
+ * @return 0 on success, -1 on failure
+ */
+typedef int (*JobFunc)(void *arg);
+
+typedef struct JobQueue JobQueue;
+typedef struct Job Job;
+struct Job {
+    uint64_t id;
+    int state;
+    time_t finished; // when the job finished, finished jobs expire
+    JobFunc func;
+    void *arg;
+    JobQueue *queue;
+    Job *next; // the next older job
+};
+
+struct JobQueue {
+    ThreadPool *pool;
+    pthread_mutex_t lock;
+    Job *jobs;       // the jobs that have not expired, newest first
+    size_t active;   // the jobs reserved, queued or running
+    size_t capacity; // the most jobs active at once
+    uint64_t next_id;
+
+    /**
+     * Claim a slot for a job, before its input has arrived
+     * @param self The job queue
+     * @return the job, NULL if the queue is full
+     */
+    Job *(*reserve)(JobQueue *self);
+
+    /**
+     * Queue a reserved job for the workers
+     * @param self The job queue
+     * @param job The reserved job
+     * @param func The work of the job
+     * @param arg Passed to func
+     */
+    void (*submit)(JobQueue *self, Job *job, JobFunc func, void *arg);
+
+    /**
+     * Record the result of a job and free its slot. The workers call this
+     * for submitted jobs, callers may finish a reserved job themselves.
+     * @param self The job queue
+     * @param job The job
+     * @param status 0 on success, -1 on failure
+     */
+    void (*finish)(JobQueue *self, Job *job, int status);
+
+    /**
+     * Forget a reserved job that will never be submitted
+     * @param self The job queue
+     * @param job The reserved job
+     */
+    void (*release)(JobQueue *self, Job *job);
+
+    /**
+     * Look up the state of a job
+     * @param self The job queue
+     * @param id The job id
+     * @return the JOB_STATE, -1 if there is no such job
+     */
+    int (*get_state)(JobQueue *self, uint64_t id);
+
+    /**
+     * Run the queued jobs to completion and free the queue
+     * @param self The job queue
+     */
+    void (*destroy)(JobQueue **self);
+};
+
+/**
+ * new_job_queue - create a bounded queue of background jobs.
+ * @param worker_num The number of threads running jobs.
+ * @param capacity The most jobs reserved, queued or running at once.
+ * @return: A pointer to the new job queue.
+ */
+extern JobQueue *new_job_queue(size_t worker_num, size_t capacity);
+#endif
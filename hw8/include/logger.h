@@ -1,10 +1,38 @@
 #ifndef _LOGGER_H_
 #define _LOGGER_H_
+
+enum LOG_LEVEL { LOG_INFO, LOG_WARN, LOG_ERROR, LOG_OFF };
+
+// the loggers of levels below this do nothing, e.g. -DLOG_MIN_LEVEL=LOG_WARN;
+// the calls remain, but nothing is copied, queued or written
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_INFO
+#endif
+
 typedef struct Logger Logger;
 struct Logger {
     void (*info_log)(const char *msg, const char *file, const int line);
     void (*warn_log)(const char *msg, const char *file, const int line);
     void (*error_log)(const char *msg, const char *file, const int line);
 };
+
+/**
+ * init_logger - Create a logger. Every logger feeds the same background
+ * writer, which is started by the first one and flushed at exit.
+ * @param self Where to store the logger
+ */
 extern void init_logger(Logger **self);
+
+/**
+ * set_log_level - Drop the records below a level from now on
+ * @param level The lowest level written
+ */
+extern void set_log_level(enum LOG_LEVEL level);
+
+/**
+ * parse_log_level - Parse the name of a level
+ * @param name "info", "warn", "error" or "off"
+ * @return the level, -1 if the name is unknown
+ */
+extern int parse_log_level(const char *name);
 #endif
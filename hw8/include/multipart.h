@@ -0,0 +1,69 @@
+#ifndef _MULTIPART_H_
+#define _MULTIPART_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#define MAX_BOUNDARY_LEN 70
+#define MAX_PART_NAME_LEN 256
+
+/**
+ * Called when the headers of a part have been parsed
+ * @param ctx The context given to the parser
+ * @param name The form field name of the part, empty if there is none
+ * @param filename The file name of the part, empty if it is not a file
+ * @return 0 to continue, anything else to stop parsing
+ */
+typedef int (*PartBegin)(void *ctx, const char *name, const char *filename);
+
+/**
+ * Called with the data of the current part as it arrives
+ * @param ctx The context given to the parser
+ * @param data The next bytes of the part
+ * @param len The number of bytes
+ * @return 0 to continue, anything else to stop parsing
+ */
+typedef int (*PartData)(void *ctx, const char *data, size_t len);
+
+typedef struct MultipartParser MultipartParser;
+struct MultipartParser {
+    char delimiter[MAX_BOUNDARY_LEN + 4]; // "\r\n--" followed by the boundary
+    size_t delimiter_len;
+    uint8_t skip[256]; // Boyer-Moore-Horspool shift for every byte value
+    char *buf;         // bytes that may still hold a delimiter or headers
+    size_t len;
+    size_t cap;
+    int state;
+    bool done; // the closing delimiter has been seen
+    PartBegin on_part_begin;
+    PartData on_part_data;
+    void *ctx;
+
+    /**
+     * Parse the next bytes of the body. Part data is passed on as soon as it
+     * cannot be the start of a delimiter.
+     * @param self The parser
+     * @param data The next bytes of the body
+     * @param len The number of bytes
+     * @return 0 on success, -1 if the body is malformed or a callback stopped
+     */
+    int (*feed)(MultipartParser *self, const char *data, size_t len);
+
+    /**
+     * Free the parser
+     * @param self The parser
+     */
+    void (*destroy)(MultipartParser **self);
+};
+
+/**
+ * new_multipart_parser - create a parser for a multipart/form-data body.
+ * @param content_type The Content-Type header holding the boundary
+ * @param on_part_begin Called when a part starts
+ * @param on_part_data Called with the data of a part
+ * @param ctx Passed to the callbacks
+ * @return: A pointer to the new parser, NULL if there is no valid boundary.
+ */
+extern MultipartParser *new_multipart_parser(const char *content_type,
+                                             PartBegin on_part_begin,
+                                             PartData on_part_data, void *ctx);
+#endif
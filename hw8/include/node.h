@@ -2,15 +2,26 @@
 #define _NODE_H_
 #include <stdint.h>
 typedef struct Node Node;
+typedef struct NodeArena NodeArena;
 #include <stdlib.h>
 
+// a full binary tree over a byte alphabet has at most 2 * 256 - 1 nodes
+#define MAX_NODE_NUM 511
+#define NO_NODE (-1)
+
 struct Node {
+    uint64_t freq;
+    int16_t p;     // index of the parent in the arena, NO_NODE for the root
+    int16_t left;  // index of the left child in the arena, NO_NODE if none
+    int16_t right; // index of the right child in the arena, NO_NODE if none
     char data;
-    int freq;
-    Node *p;
-    Node *left;
-    Node *right;
 };
-Node *create_node(char data);
+
+struct NodeArena {
+    Node nodes[MAX_NODE_NUM];
+    size_t len;
+};
+Node *create_node(NodeArena *arena, char data);
+void reset_arena(NodeArena *arena);
 void init_node_arr(Node **arr, const size_t len);
 #endif
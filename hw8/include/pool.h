@@ -0,0 +1,59 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+typedef void (*Task)(void *arg);
+
+typedef struct PoolTask PoolTask;
+struct PoolTask {
+    Task func;
+    void *arg;
+};
+
+typedef struct ThreadPool ThreadPool;
+struct ThreadPool {
+    pthread_t *threads;
+    size_t thread_num;
+    PoolTask *tasks; // ring buffer of pending tasks
+    size_t capacity;
+    size_t head;
+    size_t len;
+    bool stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+
+    /**
+     * Queue a task, waiting while the queue is full
+     * @param self The thread pool
+     * @param func The task to run on a worker
+     * @param arg The argument passed to the task
+     */
+    void (*submit)(ThreadPool *self, Task func, void *arg);
+
+    /**
+     * Queue a task unless the queue is full
+     * @param self The thread pool
+     * @param func The task to run on a worker
+     * @param arg The argument passed to the task
+     * @return true if the task was queued
+     */
+    bool (*try_submit)(ThreadPool *self, Task func, void *arg);
+
+    /**
+     * Run the queued tasks to completion, stop the workers and free the pool
+     * @param self The thread pool
+     */
+    void (*destroy)(ThreadPool **self);
+};
+
+/**
+ * new_thread_pool - create a pool of worker threads.
+ * @param thread_num The number of workers.
+ * @param capacity The number of tasks that can wait in the queue.
+ * @return: A pointer to the new thread pool.
+ */
+extern ThreadPool *new_thread_pool(size_t thread_num, size_t capacity);
+#endif
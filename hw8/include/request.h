@@ -0,0 +1,85 @@
+#ifndef _REQUEST_H_
+#define _REQUEST_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#define MAX_METHOD_LEN 16
+#define MAX_TARGET_LEN 1024
+#define MAX_HEADER_VALUE_LEN 256
+
+typedef struct Request Request;
+struct Request {
+    int fd;
+    char method[MAX_METHOD_LEN];
+    char target[MAX_TARGET_LEN]; // path and query string
+    char content_type[MAX_HEADER_VALUE_LEN];
+    char range[MAX_HEADER_VALUE_LEN]; // the Range header, empty if absent
+    uint64_t content_len;
+    bool chunked;          // Transfer-Encoding: chunked
+    bool expect_continue;  // the client waits for 100 Continue
+    bool keep_alive;       // the client keeps the connection open, cleared
+                           // before a response after which it is closed
+    char *buf;             // bytes received from the client, NUL-terminated
+    size_t len;            // the number of bytes in buf
+    size_t cap;            // the capacity of buf
+    size_t pos;            // the first byte of buf not consumed yet
+    int body_state;        // where the body decoder is in the framing
+    uint64_t remaining;    // bytes left in the body or the current chunk
+
+    /**
+     * Read the next part of the body, decoding chunked framing
+     * @param self The request
+     * @param out Where to store the body bytes
+     * @param out_len The size of out
+     * @return the number of bytes read, 0 at the end of the body, -1 if the
+     * body is malformed or the client stops sending
+     */
+    ssize_t (*read_body)(Request *self, char *out, size_t out_len);
+
+    /**
+     * Read and drop what is left of the body, so the next request on the
+     * connection can be parsed
+     * @param self The request
+     * @return 0 on success, -1 if the body is malformed or the client stops
+     * sending
+     */
+    int (*skip_body)(Request *self);
+
+    /**
+     * Tell whether the connection can carry another request once the
+     * response is sent, so the response can announce the close
+     * @param self The request
+     * @return false if the client closes it, or the rest of the body cannot
+     * be skipped
+     */
+    bool (*reusable)(const Request *self);
+
+    /**
+     * Stop sending and drop what the client still sends of the body before
+     * the connection is closed. Closing with unread bytes resets the
+     * connection, which can destroy the response before the client reads it.
+     * The wait is bounded by LINGER_TIMEOUT and MAX_LINGER_SIZE.
+     * @param self The request
+     */
+    void (*discard_body)(Request *self);
+};
+
+/**
+ * init_request - Parse the request line and headers of a request. The headers
+ * are parsed once, the body is left in the buffer for read_body.
+ * @param self The request, whose buf holds at least header_len bytes
+ * @param header_len The length of the headers including the blank line
+ * @return 0 on success, -1 if the headers are malformed
+ */
+extern int init_request(Request *self, size_t header_len);
+
+/**
+ * find_header_end - Look for the blank line ending the headers
+ * @param buf The bytes received so far
+ * @param from Where the bytes received last start
+ * @param len The number of bytes received
+ * @return the length of the headers, 0 if they are not complete yet
+ */
+extern size_t find_header_end(const char *buf, size_t from, size_t len);
+#endif
@@ -0,0 +1,61 @@
+#ifndef _RESPONSE_H_
+#define _RESPONSE_H_
+#include "request.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#define MAX_RESPONSE_HEAD 1024
+#define MAX_RESPONSE_PARTS 8
+
+typedef struct Response Response;
+struct Response {
+    char head[MAX_RESPONSE_HEAD]; // the status line and headers
+    size_t head_len;
+    bool overflow; // a header or body part did not fit
+    struct iovec parts[MAX_RESPONSE_PARTS]; // the head followed by the body
+    int part_num;
+    uint64_t content_len; // the length of the body parts
+    uint64_t file_len;    // body bytes the caller sends after the response
+    bool close;           // the connection is closed after the response
+
+    /**
+     * Add a header, the value is formatted like printf
+     * @param self The response
+     * @param name The header name
+     * @param format The format of the value
+     */
+    void (*add_header)(Response *self, const char *name, const char *format,
+                       ...) __attribute__((format(printf, 3, 4)));
+
+    /**
+     * Add a part of the body. The data is not copied and must stay valid
+     * until the response is sent.
+     * @param self The response
+     * @param data The body part
+     * @param len The length of the part
+     */
+    void (*add_body)(Response *self, const void *data, size_t len);
+
+    /**
+     * Finish the headers with the Content-Length and send the whole response
+     * in as few system calls as the socket allows
+     * @param self The response
+     * @param fd The socket
+     * @return 0 on success, -1 if the response did not fit or the client
+     * stopped receiving
+     */
+    int (*send)(Response *self, int fd);
+};
+
+/**
+ * init_response - Start a response with its status line. The response tells
+ * the client with Connection: close when the request cannot be followed by
+ * another one, so clear keep_alive first to close the connection after it.
+ * @param self The response
+ * @param req The request answered
+ * @param status The status code and reason, e.g. "200 OK"
+ */
+extern void init_response(Response *self, const Request *req,
+                          const char *status);
+#endif
@@ -1,18 +1,74 @@
 #ifndef _ROUTE_H_
 #define _ROUTE_H_
+#include "request.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
 typedef struct Router Router;
 typedef struct Route Route;
+struct Server;
+
+/**
+ * Handle a request that matched a route
+ * @param server Server object
+ * @param req The request
+ * @param route The route it matched
+ */
+typedef void (*RouteHandler)(struct Server *server, Request *req,
+                             const Route *route);
+
 struct Route {
-    char *key;
-    char *value;
-    Route *left, *right;
+    char method[MAX_METHOD_LEN];
+    const char *path;
+    size_t path_len;
+    bool prefix; // match the path and everything below it
+    RouteHandler handler;
+    const char *value; // what the handler serves, e.g. the template of a page
+    uint64_t hash;     // the hash of the method and the path
+    Route *next;       // the next route in the same bucket
 };
 
 struct Router {
-    Route *root;
-    void (*list_routes)(Route *self);
-    void (*add_route)(Route **self, char *key, char *value);
-    Route *(*search_route)(Route *self, const char *key);
+    Route *routes; // every route, in the order they were added
+    size_t route_num;
+    size_t route_cap;
+    Route **buckets; // the compiled hash table
+    size_t bucket_num;
+
+    /**
+     * Add a route, compile must be called before the next match
+     * @param self The router
+     * @param method The request method, e.g. "GET"
+     * @param path The path, without a query string
+     * @param prefix Whether the route also matches the paths below path
+     * @param handler The handler of the route
+     * @param value What the handler serves, may be NULL
+     */
+    void (*add_route)(Router *self, const char *method, const char *path,
+                      bool prefix, RouteHandler handler, const char *value);
+
+    /**
+     * Build the hash table of the routes
+     * @param self The router
+     */
+    void (*compile)(Router *self);
+
+    /**
+     * Find the route of a request. An exact route wins over a prefix route,
+     * a longer prefix wins over a shorter one.
+     * @param self The compiled router
+     * @param method The request method
+     * @param target The request target, its query string is ignored
+     * @return the route, NULL if there is none
+     */
+    const Route *(*match)(const Router *self, const char *method,
+                          const char *target);
+
+    /**
+     * Print every route
+     * @param self The router
+     */
+    void (*list_routes)(const Router *self);
 };
 
 void init_router(Router **self);
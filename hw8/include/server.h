@@ -2,22 +2,56 @@
 #define _SERVER_H_
 #include "route.h"
 typedef struct Server Server;
+#include "../include/cache.h"
+#include "../include/job.h"
 #include "../include/logger.h"
+#include "../include/pool.h"
+#include "../include/request.h"
 #include <stdlib.h>
+#include <sys/types.h>
+
+/**
+ * Handle a request and send the response. The headers are parsed, the body is
+ * read by the handler. Once the handler returns, the connection waits for the
+ * next request unless the client asked to close it or the handler cleared
+ * keep_alive before responding.
+ * @param self Server object
+ * @param req The request, its socket in blocking mode
+ */
+typedef void (*RequestHandler)(Server *self, Request *req);
+
+typedef struct Template Template;
+struct Template {
+    const char *name;   // the file name under templates/
+    const char *status; // the status code and reason sent with the page
+    char *response;     // the status line and headers followed by the page
+    size_t head_len;    // the length of the status line and headers
+    size_t len;
+};
+
 struct Server {
     int port;
     int socket;
+    int epoll_fd;
     Logger *logger;
     Router *router;
+    ThreadPool *pool;
+    RequestHandler handler;
+    pthread_mutex_t idle_lock;
+    struct Connection *idle; // connections waiting for their next request
+    Template *templates;     // every page, loaded once by config_router
+    size_t template_num;
+    Cache *cache;   // the results of earlier uploads, set up by the caller
+    JobQueue *jobs; // uploads being processed, set up by the caller
+    void (*run)(Server *self, RequestHandler handler, size_t worker_num);
     void (*config_router)(Server *self);
     const char *(*render_static_route)(Server *self, const char *endpoint);
-    void (*send_ok_response)(int client_socket, const char *body);
-    void (*send_not_found_response)(int client_socket);
-    void (*get_client_request)(int client_socket, char **client_req,
-                               size_t *req_len);
-    char *(*handle_get_requests)(Server *self, const char *route);
-    const char *(*get_file_content)(Server *self, const char *const chunk,
-                                    const size_t chunk_len, long *content_len);
+    void (*send_ok_response)(Request *req, const char *body);
+    int (*send_template)(Request *req, const Template *page);
+    int (*send_file)(int client_socket, int fd, off_t offset, size_t len);
+    void (*send_not_found_response)(Request *req);
+    void (*send_bad_request_response)(Request *req);
+    const Template *(*handle_get_requests)(Server *self, const Route *route);
     void (*parse_url_params)(Server *self, const char *url, char *out_file,
                              char *service_type);
 };
@@ -0,0 +1,35 @@
+#ifndef _SHA256_H_
+#define _SHA256_H_
+#include <stdint.h>
+#include <stdlib.h>
+#define SHA256_DIGEST_LEN 32
+
+typedef struct Sha256 Sha256;
+struct Sha256 {
+    uint32_t state[8];
+    uint64_t len;          // the number of bytes hashed so far
+    uint8_t block[64];     // the bytes that do not fill a block yet
+    size_t block_len;
+};
+
+/**
+ * sha256_init - Start a new digest
+ * @param self The digest state
+ */
+extern void sha256_init(Sha256 *self);
+
+/**
+ * sha256_update - Hash the next bytes of the message
+ * @param self The digest state
+ * @param data The bytes
+ * @param len The number of bytes
+ */
+extern void sha256_update(Sha256 *self, const void *data, size_t len);
+
+/**
+ * sha256_final - Finish the digest
+ * @param self The digest state
+ * @param digest Where to store the SHA256_DIGEST_LEN bytes of the digest
+ */
+extern void sha256_final(Sha256 *self, uint8_t digest[SHA256_DIGEST_LEN]);
+#endif
@@ -0,0 +1,74 @@
+#ifndef _STREAM_H_
+#define _STREAM_H_
+#include "tree.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef struct BlockIndex BlockIndex;
+
+typedef struct StreamEncoder StreamEncoder;
+struct StreamEncoder {
+    HuffmanTree *tree;
+    FILE *out;
+    char *block; // the raw data of the block being filled
+    size_t len;
+    BlockIndex *index;
+
+    /**
+     * Append data, compressing every block as soon as it is full
+     * @param self The encoder
+     * @param data The data to compress
+     * @param len The length of the data
+     */
+    void (*write)(StreamEncoder *self, const char *data, size_t len);
+
+    /**
+     * Compress the last block, terminate the container and free the encoder.
+     * The output file is left open.
+     * @param self The encoder
+     * @return 0 on success, -1 if writing the output failed
+     */
+    int (*finish)(StreamEncoder **self);
+};
+
+/**
+ * is_packed - Check whether a file starts with the packed container magic.
+ * @param fd The file to check, rewound to its start afterwards.
+ * @return true if the file is a packed container.
+ */
+extern bool is_packed(FILE *fd);
+
+/**
+ * new_stream_encoder - start a packed container that is fed data as it
+ * arrives.
+ * @param tree The Huffman tree.
+ * @param out The file to write to.
+ * @return: A pointer to the new encoder.
+ */
+extern StreamEncoder *new_stream_encoder(HuffmanTree *tree, FILE *out);
+
+/**
+ * compress_stream - Compress a file into a packed container, reading one
+ * block at a time so memory use does not depend on the file size.
+ * @param tree The Huffman tree.
+ * @param in The file to compress.
+ * @param out The file to write to.
+ * @param jobs The number of threads encoding blocks, 1 to stay on the caller.
+ * @return 0 on success, -1 if reading or writing failed.
+ */
+extern int compress_stream(HuffmanTree *tree, FILE *in, FILE *out,
+                           size_t jobs);
+
+/**
+ * decompress_stream - Decompress a packed container one block at a time.
+ * With more than one job, the blocks listed in the index are decoded in
+ * parallel when both files are regular files.
+ * @param tree The Huffman tree.
+ * @param in The packed container.
+ * @param out The file to write to.
+ * @param jobs The number of threads decoding blocks, 1 to stay on the caller.
+ * @return 0 on success, -1 if the container is malformed or writing failed.
+ */
+extern int decompress_stream(HuffmanTree *tree, FILE *in, FILE *out,
+                             size_t jobs);
+#endif
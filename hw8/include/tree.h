@@ -2,37 +2,82 @@
 #define _TREE_H
 #include "../include/node.h"
 #include "logger.h"
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#define SYMBOL_NUM 256
+
+#define MAX_CODE_LEN 15
+
+/*
+ * Packed container layout (integers are little-endian):
+ *   "HUF" | version:1 | block... | raw_len:4 = 0 | block_len:4 = 0
+ *   | (offset:8 | raw_offset:8) per block | raw_len:8 | block count:8
+ * and every block is coded on its own:
+ *   raw_len:4 | block_len:4 | padding bits:1 | code lengths | bit stream
+ * block_len counts the bytes after the field itself. The code length of every
+ * byte value is run-length encoded as (length << 4 | (run - 1)) bytes, and the
+ * canonical bit stream is written most significant bit first. The index after
+ * the empty end block tells where every block starts in the container and in
+ * the raw data, so blocks can be decoded independently.
+ */
+#define PACKED_MAGIC "HUF"
+#define PACKED_MAGIC_LEN 3
+#define PACKED_VERSION 4
+#define PACKED_HEADER_LEN 4
+#define BLOCK_HEADER_LEN 8
+#define INDEX_ENTRY_LEN 16
+#define INDEX_TRAILER_LEN 16
+#define BLOCK_SIZE (1 << 20)
+#define MAX_BLOCK_SIZE (1 << 26)
+// padding, the longest possible length table and codes of MAX_CODE_LEN bits
+#define MAX_BLOCK_LEN(raw_len)                                                 \
+    (1 + SYMBOL_NUM + ((size_t)(raw_len) * MAX_CODE_LEN + 7) / 8)
+
+typedef struct HuffmanCode HuffmanCode;
+struct HuffmanCode {
+    uint64_t bits; // the code, right-aligned, most significant bit first
+    uint8_t len;   // the number of bits in the code, 0 if the byte is unused
+};
 
 typedef struct HuffmanTree HuffmanTree;
 struct HuffmanTree {
     Node *root;
+    NodeArena arena; // every node of the tree, children are indices into it
     size_t size;
     Logger *logger;
+    HuffmanCode codes[SYMBOL_NUM]; // compiled code table indexed by byte
+    size_t encoded_bits;           // total length of the encoded data in bits
+    bool text_format;              // use the legacy '0'/'1' text format
+    // the table of the packed block being decoded, allocated on first use
+    // and reused for the next blocks
+    struct DecodeEntry *decode_table;
     /**
-     * Create an array of nodes from the given data
-     * @param data The data to be stored in the node
-     * @return The len of the array
+     * Count every byte value in one pass and create a leaf for each of them
+     * @param freq_node_arr The leaves, at least SYMBOL_NUM long
+     * @param data The data to be counted
+     * @param data_len The length of the data
      */
     void (*gen_freq_arr)(HuffmanTree *self, Node *freq_node_arr[],
                          const char data[], const size_t data_len);
     /**
-     * Create a Huffman tree from the given data
+     * Create a Huffman tree from the given leaves
      * @param self The Huffman tree
-     * @param data The data to be stored in the tree
-     * @param len The length of the data
+     * @param arr The leaves
+     * @param len The number of leaves
      */
     void (*build_tree)(HuffmanTree *self, Node *arr[], const size_t len);
 
     /**
-     * Encode the given data
+     * Encode the given data with the compiled code table
      * @param self The Huffman tree
      * @param data The data to be encoded
-     * @param code_table The code table to encode the data
+     * @param raw_len The length of the data
+     * @param encoded_len The length of the encoded data
      * @return the encoded data
      */
-    char *(*encode)(HuffmanTree *self, const char *data,
-                    const char **code_table, const size_t raw_len);
+    char *(*encode)(HuffmanTree *self, const char *data, const size_t raw_len,
+                    size_t *encoded_len);
     /**
      * Decode the given data
      * @param self The Huffman tree
@@ -43,17 +88,29 @@ struct HuffmanTree {
     char *(*decode)(HuffmanTree *self, char *encoded_str, size_t *decoded_len,
                     size_t raw_len);
 
+    /**
+     * Decode the body of a packed block
+     * @param self The Huffman tree
+     * @param block The block body: padding, code lengths and bit stream
+     * @param block_len The length of the block body
+     * @param out The decoded data, raw_len bytes long
+     * @param raw_len The length of the decoded data
+     * @return 0 on success, -1 if the block is malformed
+     */
+    int (*decode_block)(HuffmanTree *self, const char *block,
+                        const size_t block_len, char *out,
+                        const size_t raw_len);
+
     /**
      * Free the Huffman tree
      * @param self The Huffman tree
      */
     void (*destroy)(HuffmanTree **self);
     /**
-     * Create a Huffman tree from the given data
+     * Calculate the code of every leaf and compile them into self->codes
      * @param self The Huffman tree
-     * @param data The data to be stored in the tree
-     * @param len The length of the data
-     * @return the header of the encoded file
+     * @param arr The leaves of the tree
+     * @return the header of the encoded file, NULL unless text_format is set
      */
     const char **(*cal_code_table)(HuffmanTree *self, Node *arr[]);
 };
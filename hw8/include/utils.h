@@ -1,5 +1,7 @@
 #ifndef _UTILS_H_
 #define _UTILS_H_
+#include "tree.h"
+#include <stdio.h>
 #include <stdlib.h>
 
 /**
@@ -11,13 +13,20 @@
 extern void *must_calloc(size_t count, size_t size);
 
 /**
- * read_file - Read a file and return its contents.
+ * read_file - Map a file into memory read-only.
  * @param filename The name of the file to read.
  * @param filelen The length of the file.
- * @return A pointer to the contents of the file.
+ * @return A pointer to the contents of the file, released with release_file.
  */
 extern char *read_file(const char *filename, size_t *filelen);
 
+/**
+ * release_file - Unmap a file returned by read_file.
+ * @param data The contents of the file.
+ * @param filelen The length of the file.
+ */
+extern void release_file(char *data, const size_t filelen);
+
 /**
  * write_data - Write data to a file.
  * @param filename The name of the file to write to.
@@ -40,6 +49,38 @@ extern void write_header(const char *filename, const char **header,
                          const size_t encoded_len, const size_t raw_len,
                          const size_t header_num);
 
+/**
+ * write_packed_magic - Start a packed container.
+ * @param fd The file to write to.
+ */
+extern void write_packed_magic(FILE *fd);
+
+/**
+ * write_packed_block - Append a compressed block to a packed container.
+ * @param fd The file to write to.
+ * @param codes The canonical code table of the block.
+ * @param raw_len The length of the raw data in the block.
+ * @param encoded The packed bit stream.
+ * @param encoded_bits The number of encoded bits.
+ * @return The number of bytes written.
+ */
+extern size_t write_packed_block(FILE *fd, const HuffmanCode codes[],
+                               const size_t raw_len, const char *encoded,
+                               const size_t encoded_bits);
+
+/**
+ * write_packed_end - Terminate a packed container with an empty block and
+ * the block index.
+ * @param fd The file to write to.
+ * @param offsets Where every block starts in the container.
+ * @param raw_offsets Where every block starts in the raw data.
+ * @param block_num The number of blocks.
+ * @param raw_len The length of the raw data.
+ */
+extern void write_packed_end(FILE *fd, const uint64_t offsets[],
+                             const uint64_t raw_offsets[],
+                             const size_t block_num, const size_t raw_len);
+
 /**
  * print_header - Print encoded table to stdout.
  * @param header The header to print.
@@ -0,0 +1,286 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../include/cache.h"
+#include "../include/utils.h"
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CACHE_BUCKETS 4096
+
+typedef struct ScannedFile ScannedFile;
+struct ScannedFile {
+    CacheEntry *entry;
+    time_t mtime;
+};
+
+/**
+ * valid_key - Check that a key is made of CACHE_KEY_LEN hex digits, so it is
+ * safe to use as a file name
+ * @param key The key
+ * @return whether the key is valid
+ */
+static bool valid_key(const char *key)
+{
+    size_t len = strspn(key, "0123456789abcdef");
+    return len == CACHE_KEY_LEN && key[len] == '\0';
+}
+
+/**
+ * entry_path - Build the path of the file for a key
+ * @param self The cache
+ * @param key The key
+ * @param path Where to store the path, CACHE_PATH_LEN long
+ */
+static void entry_path(const Cache *self, const char *key, char *path)
+{
+    snprintf(path, CACHE_PATH_LEN, "%s/%.*s", self->dir, CACHE_KEY_LEN, key);
+}
+
+/**
+ * bucket_of - Pick the bucket of a key with FNV-1a
+ * @param self The cache
+ * @param key The key
+ * @return where the key is chained
+ */
+static CacheEntry **bucket_of(Cache *self, const char *key)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (; *key; key++)
+        hash = (hash ^ (uint8_t)*key) * 0x100000001b3;
+    return &self->buckets[hash % self->bucket_num];
+}
+
+/**
+ * find - Look up the entry of a key
+ * @param self The cache
+ * @param key The key
+ * @return the entry, NULL if the key is not cached
+ */
+static CacheEntry *find(Cache *self, const char *key)
+{
+    for (CacheEntry *entry = *bucket_of(self, key); entry;
+         entry = entry->chain) {
+        if (strcmp(entry->key, key) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+/**
+ * detach - Take an entry out of the use order
+ * @param self The cache
+ * @param entry The entry
+ */
+static void detach(Cache *self, CacheEntry *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        self->head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        self->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+/**
+ * push_front - Mark an entry as the most recently used
+ * @param self The cache
+ * @param entry The entry, not in the use order
+ */
+static void push_front(Cache *self, CacheEntry *entry)
+{
+    entry->next = self->head;
+    if (self->head)
+        self->head->prev = entry;
+    else
+        self->tail = entry;
+    self->head = entry;
+}
+
+/**
+ * insert - Add a new entry as the most recently used one
+ * @param self The cache
+ * @param key The key
+ * @param size The size of the cached file
+ */
+static void insert(Cache *self, const char *key, uint64_t size)
+{
+    CacheEntry *entry = must_calloc(1, sizeof(CacheEntry));
+    memcpy(entry->key, key, CACHE_KEY_LEN + 1);
+    entry->size = size;
+    CacheEntry **bucket = bucket_of(self, key);
+    entry->chain = *bucket;
+    *bucket = entry;
+    push_front(self, entry);
+    self->size += size;
+}
+
+/**
+ * evict - Drop the least recently used files until the cache fits its limit
+ * @param self The cache
+ */
+static void evict(Cache *self)
+{
+    while (self->size > self->limit && self->tail) {
+        CacheEntry *entry = self->tail;
+        CacheEntry **link = bucket_of(self, entry->key);
+        while (*link != entry)
+            link = &(*link)->chain;
+        *link = entry->chain;
+        detach(self, entry);
+        self->size -= entry->size;
+
+        // a link handed out earlier keeps the data alive for its reader
+        char path[CACHE_PATH_LEN];
+        entry_path(self, entry->key, path);
+        unlink(path);
+        free(entry);
+    }
+}
+
+/**
+ * fetch - Hard link the cached file for a key to a path
+ * @param self The cache
+ * @param key The key
+ * @param path Where the file should appear, it must not exist
+ * @return 0 on a hit, -1 on a miss
+ */
+static int fetch(Cache *self, const char *key, const char *path)
+{
+    if (!valid_key(key))
+        return -1;
+    pthread_mutex_lock(&self->lock);
+    CacheEntry *entry = find(self, key);
+    int status = -1;
+    if (entry) {
+        char cached[CACHE_PATH_LEN];
+        entry_path(self, key, cached);
+        status = link(cached, path);
+        detach(self, entry);
+        push_front(self, entry);
+    }
+    pthread_mutex_unlock(&self->lock);
+    return status == 0 ? 0 : -1;
+}
+
+/**
+ * store - Keep a file for a key
+ * @param self The cache
+ * @param key The key
+ * @param path The file, which is hard linked and stays where it is
+ */
+static void store(Cache *self, const char *key, const char *path)
+{
+    struct stat st;
+    if (!valid_key(key) || stat(path, &st) != 0 ||
+        (uint64_t)st.st_size > self->limit)
+        return;
+
+    pthread_mutex_lock(&self->lock);
+    // two identical uploads may both miss, the first one to finish wins
+    char cached[CACHE_PATH_LEN];
+    entry_path(self, key, cached);
+    if (!find(self, key) && link(path, cached) == 0) {
+        insert(self, key, (uint64_t)st.st_size);
+        evict(self);
+    }
+    pthread_mutex_unlock(&self->lock);
+}
+
+/**
+ * destroy - Free the cache, the files stay on disk
+ * @param self The cache
+ */
+static void destroy(Cache **self)
+{
+    if (!self || !*self)
+        return;
+    CacheEntry *entry = (*self)->head;
+    while (entry) {
+        CacheEntry *next = entry->next;
+        free(entry);
+        entry = next;
+    }
+    pthread_mutex_destroy(&(*self)->lock);
+    free((*self)->buckets);
+    free(*self);
+    *self = NULL;
+}
+
+/**
+ * compare_mtime - Order scanned files from the oldest to the newest
+ * @param a The first file
+ * @param b The second file
+ * @return the order of the files
+ */
+static int compare_mtime(const void *a, const void *b)
+{
+    time_t lhs = ((const ScannedFile *)a)->mtime;
+    time_t rhs = ((const ScannedFile *)b)->mtime;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/**
+ * scan - Index the files a previous run left in the cache directory. Their
+ * modification time stands in for the use order.
+ * @param self The cache
+ */
+static void scan(Cache *self)
+{
+    DIR *dir = opendir(self->dir);
+    if (!dir)
+        return;
+    size_t file_num = 0, cap = 64;
+    ScannedFile *files = must_calloc(cap, sizeof(ScannedFile));
+    struct dirent *dirent;
+    while ((dirent = readdir(dir))) {
+        char path[CACHE_PATH_LEN];
+        struct stat st;
+        if (!valid_key(dirent->d_name))
+            continue;
+        entry_path(self, dirent->d_name, path);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        if (file_num == cap) {
+            cap *= 2;
+            ScannedFile *grown = realloc(files, cap * sizeof(ScannedFile));
+            if (!grown)
+                break;
+            files = grown;
+        }
+        insert(self, dirent->d_name, (uint64_t)st.st_size);
+        files[file_num++] =
+            (ScannedFile){.entry = self->head, .mtime = st.st_mtime};
+    }
+    closedir(dir);
+
+    // rebuild the use order so the newest file is evicted last
+    qsort(files, file_num, sizeof(ScannedFile), compare_mtime);
+    for (size_t i = 0; i < file_num; i++) {
+        detach(self, files[i].entry);
+        push_front(self, files[i].entry);
+    }
+    free(files);
+    evict(self);
+}
+
+Cache *new_cache(const char *dir, uint64_t limit)
+{
+    Cache *self = must_calloc(1, sizeof(Cache));
+    snprintf(self->dir, CACHE_DIR_LEN, "%s", dir);
+    self->limit = limit;
+    self->bucket_num = CACHE_BUCKETS;
+    self->buckets = must_calloc(self->bucket_num, sizeof(CacheEntry *));
+    pthread_mutex_init(&self->lock, NULL);
+    self->fetch = &fetch;
+    self->store = &store;
+    self->destroy = &destroy;
+
+    mkdir(dir, 0755);
+    scan(self);
+    return self;
+}
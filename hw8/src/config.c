@@ -35,6 +35,9 @@ static void print_help(void)
     printf("  -o, --output <file>   The output file\n");
     printf("  -h, --help            Print this message\n");
     printf("  -s, --server          Run in server mode\n");
+    printf("  -t, --text            Compress to the legacy text format\n");
+    printf("  -j, --jobs <N>        Process blocks on N threads\n");
+    printf("  -l, --log <level>     Log info, warn, error or off\n");
     exit(EXIT_SUCCESS);
 }
 
@@ -50,6 +53,9 @@ static Config *init_config(void)
     config->input_file = NULL;
     config->output_file = NULL;
     config->using_server = false;
+    config->text_format = false;
+    config->jobs = 1;
+    config->log_level = LOG_INFO;
     return config;
 }
 
@@ -89,6 +95,12 @@ Config *new_config(const int argc, const char *argv[])
             strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0;
         bool is_output =
             strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0;
+        bool is_text =
+            strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--text") == 0;
+        bool is_jobs =
+            strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0;
+        bool is_log =
+            strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--log") == 0;
 
         if (is_mode) {
             bool is_compress = strcmp(argv[i], "-c") == 0 ||
@@ -105,6 +117,19 @@ Config *new_config(const int argc, const char *argv[])
             print_help();
         } else if (is_server) {
             config->using_server = true;
+        } else if (is_text) {
+            config->text_format = true;
+        } else if (is_jobs) {
+            check_arg(argv[i + 1], "-j/--jobs requires a number");
+            long jobs = strtol(argv[++i], NULL, 10);
+            check_arg(jobs >= 1 && jobs <= MAX_JOBS,
+                      "-j/--jobs must be between 1 and 256");
+            config->jobs = (size_t)jobs;
+        } else if (is_log) {
+            check_arg(argv[i + 1], "-l/--log requires a level");
+            int level = parse_log_level(argv[++i]);
+            check_arg(level >= 0, "-l/--log must be info, warn, error or off");
+            config->log_level = (enum LOG_LEVEL)level;
         } else {
             fprintf(stderr, "Error: Unknown option: %s\n", argv[i]);
             free_config(&config);
@@ -0,0 +1,171 @@
+#include "../include/job.h"
+#include "../include/utils.h"
+#include <stdbool.h>
+#define JOB_TTL 3600
+
+/**
+ * expire - Forget the jobs that finished more than JOB_TTL seconds ago, the
+ * caller holds the lock
+ * @param self The job queue
+ */
+static void expire(JobQueue *self)
+{
+    time_t now = time(NULL);
+    for (Job **link = &self->jobs; *link;) {
+        Job *job = *link;
+        bool expired = (job->state == JOB_DONE || job->state == JOB_FAILED) &&
+                       now - job->finished > JOB_TTL;
+        if (expired) {
+            *link = job->next;
+            free(job);
+        } else {
+            link = &job->next;
+        }
+    }
+}
+
+/**
+ * reserve - Claim a slot for a job
+ * @param self The job queue
+ * @return the job, NULL if the queue is full
+ */
+static Job *reserve(JobQueue *self)
+{
+    pthread_mutex_lock(&self->lock);
+    expire(self);
+    if (self->active == self->capacity) {
+        pthread_mutex_unlock(&self->lock);
+        return NULL;
+    }
+    Job *job = must_calloc(1, sizeof(Job));
+    job->id = ++self->next_id;
+    job->state = JOB_QUEUED;
+    job->queue = self;
+    job->next = self->jobs;
+    self->jobs = job;
+    self->active++;
+    pthread_mutex_unlock(&self->lock);
+    return job;
+}
+
+/**
+ * run_job - Run a job on a worker and record its result
+ * @param arg The job
+ */
+static void run_job(void *arg)
+{
+    Job *job = arg;
+    JobQueue *self = job->queue;
+    pthread_mutex_lock(&self->lock);
+    job->state = JOB_RUNNING;
+    pthread_mutex_unlock(&self->lock);
+    self->finish(self, job, job->func(job->arg));
+}
+
+/**
+ * submit - Queue a reserved job for the workers. The pool holds as many
+ * tasks as there are slots, so this never waits.
+ * @param self The job queue
+ * @param job The reserved job
+ * @param func The work of the job
+ * @param arg Passed to func
+ */
+static void submit(JobQueue *self, Job *job, JobFunc func, void *arg)
+{
+    job->func = func;
+    job->arg = arg;
+    self->pool->submit(self->pool, run_job, job);
+}
+
+/**
+ * finish - Record the result of a job and free its slot
+ * @param self The job queue
+ * @param job The job
+ * @param status 0 on success, -1 on failure
+ */
+static void finish(JobQueue *self, Job *job, int status)
+{
+    pthread_mutex_lock(&self->lock);
+    job->state = status == 0 ? JOB_DONE : JOB_FAILED;
+    job->finished = time(NULL);
+    self->active--;
+    pthread_mutex_unlock(&self->lock);
+}
+
+/**
+ * release - Forget a reserved job that will never be submitted
+ * @param self The job queue
+ * @param job The reserved job
+ */
+static void release(JobQueue *self, Job *job)
+{
+    pthread_mutex_lock(&self->lock);
+    for (Job **link = &self->jobs; *link; link = &(*link)->next) {
+        if (*link == job) {
+            *link = job->next;
+            break;
+        }
+    }
+    self->active--;
+    pthread_mutex_unlock(&self->lock);
+    free(job);
+}
+
+/**
+ * get_state - Look up the state of a job
+ * @param self The job queue
+ * @param id The job id
+ * @return the JOB_STATE, -1 if there is no such job
+ */
+static int get_state(JobQueue *self, uint64_t id)
+{
+    int state = -1;
+    pthread_mutex_lock(&self->lock);
+    expire(self);
+    for (Job *job = self->jobs; job; job = job->next) {
+        if (job->id == id) {
+            state = job->state;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&self->lock);
+    return state;
+}
+
+/**
+ * destroy - Run the queued jobs to completion and free the queue
+ * @param self The job queue
+ */
+static void destroy(JobQueue **self)
+{
+    if (!self || !*self)
+        return;
+    (*self)->pool->destroy(&(*self)->pool);
+    Job *job = (*self)->jobs;
+    while (job) {
+        Job *next = job->next;
+        free(job);
+        job = next;
+    }
+    pthread_mutex_destroy(&(*self)->lock);
+    free(*self);
+    *self = NULL;
+}
+
+JobQueue *new_job_queue(size_t worker_num, size_t capacity)
+{
+    JobQueue *self = must_calloc(1, sizeof(JobQueue));
+    self->pool = new_thread_pool(worker_num, capacity);
+    pthread_mutex_init(&self->lock, NULL);
+    self->jobs = NULL;
+    self->active = 0;
+    self->capacity = capacity;
+    self->next_id = 0;
+    self->reserve = &reserve;
+    self->submit = &submit;
+    self->finish = &finish;
+    self->release = &release;
+    self->get_state = &get_state;
+    self->destroy = &destroy;
+    return self;
+}
@@ -1,35 +1,352 @@
+#define _POSIX_C_SOURCE 200809L
 #include "../include/logger.h"
 #include "../include/utils.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
-#include <unistd.h>
+#define LOG_RING_SIZE 1024 // records per thread, a power of two
+#define LOG_MSG_LEN 240
+#define LOG_LINE_LEN 1024
+#define LOG_IDLE_NS 5000000 // how long the writer sleeps when there is nothing
+
+typedef struct LogRecord LogRecord;
+struct LogRecord {
+    int64_t ms; // the cached wall clock in milliseconds
+    int level;
+    const char *file;
+    int line;
+    char msg[LOG_MSG_LEN];
+};
+
+// one producer, the thread owning it, and one consumer, the writer
+typedef struct LogRing LogRing;
+struct LogRing {
+    LogRecord records[LOG_RING_SIZE];
+    size_t head; // the next record to write out, moved by the writer
+    size_t tail; // the next free slot, moved by the owning thread
+    bool closed; // the thread has exited, free the ring once it is drained
+    LogRing *next;
+};
+
+static struct {
+    pthread_once_t once;
+    pthread_key_t key;
+    pthread_mutex_t lock; // guards the list of rings and direct writes
+    LogRing *rings;
+    pthread_t writer;
+    bool stopping;
+    bool stopped; // the writer is gone, records are written directly
+    int level;
+    int64_t now_ms;
+    size_t dropped;
+} backend = {.once = PTHREAD_ONCE_INIT,
+             .lock = PTHREAD_MUTEX_INITIALIZER,
+             .level = LOG_INFO};
+
+static const char *level_names[] = {"info", "warn", "error", "off"};
+
+/**
+ * clock_ms - Read the wall clock
+ * @return the milliseconds since the epoch
+ */
+static int64_t clock_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * append_json - Append a JSON string literal to a line
+ * @param line The line
+ * @param len The length of the line, moved past the string
+ * @param text The text to quote
+ */
+static void append_json(char *line, size_t *len, const char *text)
+{
+    // the worst escape takes 6 bytes, leave room for the closing quote
+    line[(*len)++] = '"';
+    for (; *text && *len + 8 < LOG_LINE_LEN; text++) {
+        unsigned char c = (unsigned char)*text;
+        if (c == '"' || c == '\\') {
+            line[(*len)++] = '\\';
+            line[(*len)++] = (char)c;
+        } else if (c < 0x20) {
+            *len += (size_t)snprintf(line + *len, 7, "\\u%04x", c);
+        } else {
+            line[(*len)++] = (char)c;
+        }
+    }
+    line[(*len)++] = '"';
+}
+
+/**
+ * write_record - Format a record as a JSON line and write it out, info to
+ * stdout and the rest to stderr
+ * @param record The record
+ */
+static void write_record(const LogRecord *record)
+{
+    // the date only changes once a second, so format it once a second
+    static time_t cached_sec = -1;
+    static char cached_date[32];
+    time_t sec = (time_t)(record->ms / 1000);
+    if (sec != cached_sec) {
+        struct tm tm;
+        gmtime_r(&sec, &tm);
+        strftime(cached_date, sizeof(cached_date), "%Y-%m-%dT%H:%M:%S", &tm);
+        cached_sec = sec;
+    }
+
+    char line[LOG_LINE_LEN];
+    size_t len = (size_t)snprintf(line, LOG_LINE_LEN,
+                                  "{\"ts\":\"%s.%03dZ\",\"level\":\"%s\","
+                                  "\"file\":",
+                                  cached_date, (int)(record->ms % 1000),
+                                  level_names[record->level]);
+    append_json(line, &len, record->file);
+    len += (size_t)snprintf(line + len, LOG_LINE_LEN - len,
+                            ",\"line\":%d,\"msg\":", record->line);
+    append_json(line, &len, record->msg);
+    line[len++] = '}';
+    line[len++] = '\n';
+    fwrite(line, 1, len, record->level == LOG_INFO ? stdout : stderr);
+}
+
+/**
+ * drain - Write out every record the threads have queued, the caller holds
+ * the lock
+ * @return whether anything was written
+ */
+static bool drain(void)
+{
+    bool wrote = false;
+    for (LogRing **link = &backend.rings; *link;) {
+        LogRing *ring = *link;
+        // read closed first, a ring closed after this is drained next time
+        bool closed = __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE);
+        size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        for (size_t head = ring->head; head != tail; head++) {
+            write_record(&ring->records[head & (LOG_RING_SIZE - 1)]);
+            wrote = true;
+        }
+        __atomic_store_n(&ring->head, tail, __ATOMIC_RELEASE);
+
+        if (closed) {
+            *link = ring->next;
+            free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+
+    size_t dropped = __atomic_exchange_n(&backend.dropped, 0, __ATOMIC_RELAXED);
+    if (dropped) {
+        LogRecord record = {.ms = backend.now_ms,
+                            .level = LOG_WARN,
+                            .file = __FILE__,
+                            .line = __LINE__};
+        snprintf(record.msg, LOG_MSG_LEN, "Dropped %zu log records", dropped);
+        write_record(&record);
+        wrote = true;
+    }
+    if (wrote) {
+        fflush(stdout);
+        fflush(stderr);
+    }
+    return wrote;
+}
+
+/**
+ * run_writer - Drain the rings until the process exits, and keep the cached
+ * clock ticking for the threads that log
+ * @param arg Unused
+ * @return NULL
+ */
+static void *run_writer(void *arg __attribute__((unused)))
+{
+    while (true) {
+        __atomic_store_n(&backend.now_ms, clock_ms(), __ATOMIC_RELAXED);
+        bool stopping = __atomic_load_n(&backend.stopping, __ATOMIC_ACQUIRE);
+        pthread_mutex_lock(&backend.lock);
+        bool wrote = drain();
+        pthread_mutex_unlock(&backend.lock);
+        if (stopping)
+            return NULL;
+        if (!wrote) {
+            struct timespec idle = {.tv_sec = 0, .tv_nsec = LOG_IDLE_NS};
+            nanosleep(&idle, NULL);
+        }
+    }
+}
+
+/**
+ * stop_writer - Flush what is queued at exit and write directly from then on
+ */
+static void stop_writer(void)
+{
+    __atomic_store_n(&backend.stopping, true, __ATOMIC_RELEASE);
+    pthread_join(backend.writer, NULL);
+    pthread_mutex_lock(&backend.lock);
+    drain();
+    __atomic_store_n(&backend.stopped, true, __ATOMIC_RELEASE);
+    // a thread that missed the flag may have queued a record since
+    drain();
+    pthread_mutex_unlock(&backend.lock);
+}
+
+/**
+ * close_ring - Hand the ring of an exiting thread to the writer
+ * @param ring The ring
+ */
+static void close_ring(void *ring)
+{
+    __atomic_store_n(&((LogRing *)ring)->closed, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * start_writer - Start the background writer, once per process
+ */
+static void start_writer(void)
+{
+    backend.now_ms = clock_ms();
+    pthread_key_create(&backend.key, close_ring);
+    if (pthread_create(&backend.writer, NULL, run_writer, NULL) != 0) {
+        perror("Error creating thread");
+        exit(1);
+    }
+    atexit(stop_writer);
+}
+
+/**
+ * get_ring - Find the ring of the calling thread, creating it on first use
+ * @return the ring
+ */
+static LogRing *get_ring(void)
+{
+    LogRing *ring = pthread_getspecific(backend.key);
+    if (ring)
+        return ring;
+    ring = must_calloc(1, sizeof(LogRing));
+    pthread_setspecific(backend.key, ring);
+    pthread_mutex_lock(&backend.lock);
+    ring->next = backend.rings;
+    backend.rings = ring;
+    pthread_mutex_unlock(&backend.lock);
+    return ring;
+}
+
+/**
+ * write_direct - Write a record right away once the writer is gone
+ * @param level The level of the record
+ * @param msg The message
+ * @param file The source file
+ * @param line The source line
+ */
+static void write_direct(int level, const char *msg, const char *file,
+                         int line)
+{
+    LogRecord record = {.ms = clock_ms(),
+                        .level = level,
+                        .file = file,
+                        .line = line};
+    snprintf(record.msg, LOG_MSG_LEN, "%s", msg);
+    pthread_mutex_lock(&backend.lock);
+    write_record(&record);
+    fflush(level == LOG_INFO ? stdout : stderr);
+    pthread_mutex_unlock(&backend.lock);
+}
+
+/**
+ * enqueue - Queue a record on the ring of the calling thread. Only the slot
+ * is written, the formatting is left to the writer. Info and warnings are
+ * dropped when the ring is full, errors wait for room.
+ * @param level The level of the record
+ * @param msg The message
+ * @param file The source file
+ * @param line The source line
+ */
+static void enqueue(int level, const char *msg, const char *file, int line)
+{
+    if (level < __atomic_load_n(&backend.level, __ATOMIC_RELAXED))
+        return;
+
+    if (__atomic_load_n(&backend.stopped, __ATOMIC_ACQUIRE)) {
+        write_direct(level, msg, file, line);
+        return;
+    }
+
+    LogRing *ring = get_ring();
+    size_t tail = ring->tail;
+    while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) ==
+           LOG_RING_SIZE) {
+        if (level != LOG_ERROR) {
+            __atomic_add_fetch(&backend.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        // nobody drains the ring any more once the writer has stopped
+        if (__atomic_load_n(&backend.stopped, __ATOMIC_ACQUIRE)) {
+            write_direct(level, msg, file, line);
+            return;
+        }
+        struct timespec wait = {.tv_sec = 0, .tv_nsec = LOG_IDLE_NS};
+        nanosleep(&wait, NULL);
+    }
+    LogRecord *record = &ring->records[tail & (LOG_RING_SIZE - 1)];
+    record->ms = __atomic_load_n(&backend.now_ms, __ATOMIC_RELAXED);
+    record->level = level;
+    record->file = file;
+    record->line = line;
+    snprintf(record->msg, LOG_MSG_LEN, "%s", msg);
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
 
 static void info_logger(const char *msg, const char *filename, const int line)
 {
-    time_t now;
-    time(&now);
-    fprintf(stdout, "%s [INFO] %s:%d %s\n", ctime(&now), filename, line, msg);
+    enqueue(LOG_INFO, msg, filename, line);
 }
 
 static void warn_logger(const char *msg, const char *filename, const int line)
 {
-    time_t now;
-    time(&now);
-    fprintf(stderr, "%s [WARN] %s:%d %s\n", ctime(&now), filename, line, msg);
+    enqueue(LOG_WARN, msg, filename, line);
 }
 
 static void error_logger(const char *msg, const char *filename, const int line)
 {
-    time_t now;
-    time(&now);
-    fprintf(stderr, "%s [ERROR] %s:%d %s\n", ctime(&now), filename, line, msg);
+    enqueue(LOG_ERROR, msg, filename, line);
+}
+
+// bound in place of the levels below LOG_MIN_LEVEL
+static void skip_logger(const char *msg __attribute__((unused)),
+                        const char *filename __attribute__((unused)),
+                        const int line __attribute__((unused)))
+{
+}
+
+void set_log_level(enum LOG_LEVEL level)
+{
+    __atomic_store_n(&backend.level, (int)level, __ATOMIC_RELAXED);
+}
+
+int parse_log_level(const char *name)
+{
+    for (int i = LOG_INFO; i <= LOG_OFF; i++) {
+        if (strcmp(name, level_names[i]) == 0)
+            return i;
+    }
+    return -1;
 }
 
 void init_logger(Logger **self)
 {
+    pthread_once(&backend.once, start_writer);
     *self = (Logger *)must_calloc(1, sizeof(Logger));
-    (*self)->info_log = &info_logger;
-    (*self)->warn_log = &warn_logger;
-    (*self)->error_log = &error_logger;
+    (*self)->info_log = LOG_MIN_LEVEL <= LOG_INFO ? &info_logger : &skip_logger;
+    (*self)->warn_log = LOG_MIN_LEVEL <= LOG_WARN ? &warn_logger : &skip_logger;
+    (*self)->error_log =
+        LOG_MIN_LEVEL <= LOG_ERROR ? &error_logger : &skip_logger;
     (*self)->info_log("Logger initialized", __FILE__, __LINE__);
 }
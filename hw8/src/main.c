@@ -1,36 +1,49 @@
 #include "../include/config.h"
+#include "../include/multipart.h"
 #include "../include/node.h"
+#include "../include/response.h"
+#include "../include/sha256.h"
 #include "../include/server.h"
+#include "../include/stream.h"
 #include "../include/tree.h"
 #include "../include/utils.h"
-#include <limits.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #define SERVER_PORT 8000
+#define SERVER_WORKERS 16
+#define JOB_WORKERS 4
+#define MAX_UPLOAD_JOBS 64
 #define BUFFER_SIZE 8192
 #define MAX_CLIENT_MSG_SIZE 4096
 #define MAX_HEADER_LINE_SIZE 1024
+#define UPLOAD_CHUNK_SIZE 65536
+#define PATH_LEN 128
+#define CACHE_DIR "cache"
+#define CACHE_LIMIT ((uint64_t)1 << 30)
 
 void compress(HuffmanTree *tree, const char *const output_file, char *raw_data,
               size_t raw_len)
 {
-    // read file and generate frequency array
     tree->logger->info_log("Start compressing", __FILE__, __LINE__);
-    Node **tree_node_arr = must_calloc(raw_len, sizeof(Node *));
+
+    // generate frequency array
+    Node **tree_node_arr = must_calloc(SYMBOL_NUM, sizeof(Node *));
 
     // build tree and calculate code table
     tree->gen_freq_arr(tree, tree_node_arr, raw_data, raw_len);
-    tree->build_tree(tree, tree_node_arr, raw_len);
+    tree->build_tree(tree, tree_node_arr, tree->size);
 
     const char **code_table = tree->cal_code_table(tree, tree_node_arr);
-    char *encoded_data = tree->encode(tree, raw_data, code_table, raw_len);
+    size_t encoded_len = 0;
+    char *encoded_data = tree->encode(tree, raw_data, raw_len, &encoded_len);
     tree->logger->info_log("Done compressing", __FILE__, __LINE__);
 
     // write encoded header and encoded file to output file
-    size_t encoded_len = strlen(encoded_data);
     write_header(output_file, code_table, encoded_len, raw_len, tree->size);
     write_data(output_file, "ab", encoded_data, encoded_len);
 
@@ -41,16 +54,79 @@ void compress(HuffmanTree *tree, const char *const output_file, char *raw_data,
     free(encoded_data);
     for (size_t i = 0; i < tree->size; i++)
         free((void *)code_table[i]);
+    free(code_table);
+    free(tree_node_arr);
 }
 
-void decompress(HuffmanTree *tree, const char *const output_file,
-                char *raw_data, const size_t raw_len)
+int decompress(HuffmanTree *tree, const char *const output_file,
+               char *raw_data, const size_t raw_len)
 {
     tree->logger->info_log("Start decompressing", __FILE__, __LINE__);
     size_t decoded_len = 0;
     char *decoded_data = tree->decode(tree, raw_data, &decoded_len, raw_len);
+    if (!decoded_data) {
+        tree->logger->error_log("Failed to decompress", __FILE__, __LINE__);
+        return -1;
+    }
     write_data(output_file, "wb", decoded_data, decoded_len);
+    free(decoded_data);
     tree->logger->info_log("Done decompressing", __FILE__, __LINE__);
+    return 0;
+}
+
+/**
+ * process_file - compress or decompress a file
+ * @tree: The Huffman tree
+ * @mode: COMPRESS or DECOMPRESS
+ * @input_file: The file to read
+ * @output_file: The file to write
+ * @jobs: The number of threads processing blocks
+ *
+ * Return: 0 on success, -1 otherwise
+ */
+static int process_file(HuffmanTree *tree, enum MODE mode,
+                        const char *input_file, const char *output_file,
+                        size_t jobs)
+{
+    FILE *in = fopen(input_file, "rb");
+    if (in == NULL) {
+        perror("Error opening file");
+        return -1;
+    }
+
+    // packed containers are streamed a block at a time, only the legacy text
+    // format needs the whole file in memory
+    bool streaming = mode == COMPRESS ? !tree->text_format : is_packed(in);
+    if (!streaming) {
+        fclose(in);
+        size_t raw_data_len = 0;
+        char *raw_data = read_file(input_file, &raw_data_len);
+        int status = 0;
+        if (mode == COMPRESS)
+            compress(tree, output_file, raw_data, raw_data_len);
+        else
+            status = decompress(tree, output_file, raw_data, raw_data_len);
+        release_file(raw_data, raw_data_len);
+        return status;
+    }
+
+    FILE *out = fopen(output_file, "wb");
+    if (out == NULL) {
+        perror("Error opening file");
+        fclose(in);
+        return -1;
+    }
+    int status = mode == COMPRESS ? compress_stream(tree, in, out, jobs)
+                                  : decompress_stream(tree, in, out, jobs);
+    // a truncated output is discarded, unless it is not a file of our own
+    struct stat st;
+    bool regular = fstat(fileno(out), &st) == 0 && S_ISREG(st.st_mode);
+    if (fclose(out) != 0)
+        status = -1;
+    if (status != 0 && regular)
+        unlink(output_file);
+    fclose(in);
+    return status == 0 ? 0 : -1;
 }
 
 /**
@@ -60,135 +136,437 @@ void decompress(HuffmanTree *tree, const char *const output_file,
 static void cli_mode(Config *config)
 {
     HuffmanTree *tree = new_huffman_tree();
-    size_t raw_data_len = 0;
-    char *raw_data = read_file(config->input_file, &raw_data_len);
+    tree->text_format = config->text_format;
     tree->logger->info_log("Starting CLI mode", __FILE__, __LINE__);
-    (config->mode == COMPRESS)
-        ? compress(tree, config->output_file, raw_data, raw_data_len)
-        : decompress(tree, config->output_file, raw_data, raw_data_len);
+    int status = process_file(tree, config->mode, config->input_file,
+                              config->output_file, config->jobs);
     tree->destroy(&tree);
     free(tree);
+    if (status != 0)
+        exit(EXIT_FAILURE);
 }
 
+typedef struct Upload Upload;
+struct Upload {
+    FILE *spool; // the file as it was uploaded
+    Sha256 hash; // the cache key, hashed while the file arrives
+    bool in_file;           // the current part is the uploaded file
+    bool seen_file;
+};
+
 /**
- * handle_upload - Handle file upload (Compress or Decompress)
- * @param server Server object
- * @param client_socket Client socket
+ * valid_file_name - Check that a file name stays inside downloads/
+ * @param name The file name from the query string
+ * @return true if the name is usable
+ */
+static bool valid_file_name(const char *name)
+{
+    return *name && *name != '.' && !strchr(name, '/');
+}
+
+/**
+ * upload_part_begin - Pick the first file of the form
+ * @param ctx The upload
+ * @param name The form field name of the part
+ * @param filename The file name of the part
+ * @return 0
  */
-static void handle_upload(Server *server, const char *const chunk,
-                          size_t chunk_len)
+static int upload_part_begin(void *ctx, const char *name, const char *filename)
 {
-    char output_file[100];
-    char service_type[100];
+    Upload *upload = ctx;
+    upload->in_file = !upload->seen_file &&
+                      (*filename || strcmp(name, "in_file") == 0);
+    upload->seen_file |= upload->in_file;
+    return 0;
+}
+
+/**
+ * upload_part_data - Hash the uploaded file and spool it as it arrives
+ * @param ctx The upload
+ * @param data The next bytes of the part
+ * @param len The number of bytes
+ * @return 0 on success, -1 if the spool file cannot be written
+ */
+static int upload_part_data(void *ctx, const char *data, size_t len)
+{
+    Upload *upload = ctx;
+    if (!upload->in_file)
+        return 0;
+    sha256_update(&upload->hash, data, len);
+    return fwrite(data, 1, len, upload->spool) == len ? 0 : -1;
+}
+
+/**
+ * cache_key - Turn the digest of an upload into a cache key
+ * @param hash The digest state of the operation and the file
+ * @param key Where to store the CACHE_KEY_LEN hex digits
+ */
+static void cache_key(Sha256 *hash, char key[CACHE_KEY_LEN + 1])
+{
+    uint8_t digest[SHA256_DIGEST_LEN];
+    sha256_final(hash, digest);
+    for (size_t i = 0; i < SHA256_DIGEST_LEN; i++)
+        snprintf(key + i * 2, 3, "%02x", digest[i]);
+}
+
+typedef struct UploadJob UploadJob;
+struct UploadJob {
+    enum MODE mode;
+    char key[CACHE_KEY_LEN + 1];
+    char path[PATH_LEN];       // where the result goes once it is complete
+    char tmp_path[PATH_LEN];   // where the result is written
+    char spool_path[PATH_LEN]; // the uploaded file
+    Cache *cache;
+};
+
+/**
+ * publish_result - Cache a finished result and move it into downloads/
+ * @param job The upload job
+ * @param status 0 if the result at tmp_path is complete
+ * @return 0 on success, -1 otherwise
+ */
+static int publish_result(UploadJob *job, int status)
+{
+    if (status == 0) {
+        job->cache->store(job->cache, job->key, job->tmp_path);
+        status = rename(job->tmp_path, job->path);
+    }
+    if (status != 0)
+        unlink(job->tmp_path);
+    return status == 0 ? 0 : -1;
+}
+
+/**
+ * run_upload_job - Compress or decompress an uploaded file on a job worker
+ * and move the result into downloads/
+ * @param arg The upload job, freed when done
+ * @return 0 on success, -1 otherwise
+ */
+static int run_upload_job(void *arg)
+{
+    UploadJob *job = arg;
     HuffmanTree *tree = new_huffman_tree();
+    int status =
+        process_file(tree, job->mode, job->spool_path, job->tmp_path, 1);
+    tree->destroy(&tree);
+    free(tree->logger);
+    free(tree);
+
+    unlink(job->spool_path);
+    status = publish_result(job, status);
+    free(job);
+    return status;
+}
+
+/**
+ * send_job_response - Tell the client where to poll for its job
+ * @param req The request
+ * @param job The job
+ */
+static void send_job_response(Request *req, const Job *job)
+{
+    char body[128];
+    snprintf(body, sizeof(body), "{\"id\":%llu}",
+             (unsigned long long)job->id);
+    Response resp;
+    init_response(&resp, req, "202 Accepted");
+    resp.add_header(&resp, "Content-Type", "application/json");
+    resp.add_header(&resp, "Location", "/status?id=%llu",
+                    (unsigned long long)job->id);
+    resp.add_body(&resp, body, strlen(body));
+    resp.send(&resp, req->fd);
+}
+
+/**
+ * receive_upload - Hash the file of an upload and spool it to disk as it
+ * arrives. Nothing is encoded yet, the hash decides whether it has to be.
+ * @param server Server object
+ * @param req The upload request
+ * @param job The job, whose spool_path and key are filled in
+ * @return 0 on success, -1 if the request is malformed
+ */
+static int receive_upload(Server *server, Request *req, UploadJob *job)
+{
+    Upload upload = {.spool = NULL};
+    MultipartParser *parser = new_multipart_parser(
+        req->content_type, upload_part_begin, upload_part_data, &upload);
+    if (!parser)
+        return -1;
+    upload.spool = fopen(job->spool_path, "wb");
+    if (!upload.spool) {
+        server->logger->error_log("Failed to open output", __FILE__, __LINE__);
+        parser->destroy(&parser);
+        return -1;
+    }
+    // the same bytes give different results for the two services
+    sha256_init(&upload.hash);
+    sha256_update(&upload.hash, &job->mode, sizeof(job->mode));
+
+    // feed the body to the parser as it arrives
+    char buf[UPLOAD_CHUNK_SIZE];
+    ssize_t size_read;
+    int status = 0;
+    while (status == 0 &&
+           (size_read = req->read_body(req, buf, sizeof(buf))) > 0)
+        status = parser->feed(parser, buf, (size_t)size_read);
+    if (size_read < 0 || !parser->done || !upload.seen_file)
+        status = -1;
+    parser->destroy(&parser);
+
+    if (fclose(upload.spool) != 0)
+        status = -1;
+    cache_key(&upload.hash, job->key);
+    return status;
+}
+
+/**
+ * handle_upload - Handle file upload (Compress or Decompress). The file is
+ * hashed and spooled as it arrives. A file uploaded before for the same
+ * service is answered from the cache without encoding or decoding anything,
+ * any other file is processed by a job in the background. The client gets
+ * the job id to poll /status?id= with, and the result appears under
+ * /download once it is done.
+ * @param server Server object
+ * @param req The upload request
+ */
+static void handle_upload(Server *server, Request *req,
+                          const Route *route __attribute__((unused)))
+{
+    char output_file[100] = "";
+    char service_type[100] = "";
     server->logger->info_log("Handling upload request", __FILE__, __LINE__);
     server->logger->info_log("Parsing url params", __FILE__, __LINE__);
-    server->parse_url_params(server, chunk, output_file, service_type);
+    server->parse_url_params(server, req->target, output_file, service_type);
+    if (!valid_file_name(output_file)) {
+        server->send_bad_request_response(req);
+        return;
+    }
 
-    // get file content and length
-    long len = 0;
-    char *content =
-        (char *)server->get_file_content(server, chunk, chunk_len, &len);
+    // turn the upload away before its body arrives when the box is busy
+    Job *job = server->jobs->reserve(server->jobs);
+    if (!job) {
+        server->logger->warn_log("Job queue full", __FILE__, __LINE__);
+        req->keep_alive = false;
+        Response resp;
+        init_response(&resp, req, "429 Too Many Requests");
+        resp.add_header(&resp, "Retry-After", "1");
+        resp.send(&resp, req->fd);
+        return;
+    }
 
-    // compress or decompress the file
-    char path[100] = "downloads/";
-    strcat(path, output_file);
-    (strcmp(service_type, "compress") == 0)
-        ? compress(tree, path, content, (size_t)len)
-        : decompress(tree, path, content, (size_t)len);
+    // the temporary files are named after the job, so uploads to the same
+    // name do not clobber each other
+    UploadJob *upload = must_calloc(1, sizeof(UploadJob));
+    upload->mode =
+        strcmp(service_type, "compress") == 0 ? COMPRESS : DECOMPRESS;
+    upload->cache = server->cache;
+    unsigned long long id = (unsigned long long)job->id;
+    snprintf(upload->path, PATH_LEN, "downloads/%s", output_file);
+    snprintf(upload->tmp_path, PATH_LEN, "downloads/.%s.%llu.tmp",
+             output_file, id);
+    snprintf(upload->spool_path, PATH_LEN, "downloads/.%s.%llu.upload",
+             output_file, id);
+    if (receive_upload(server, req, upload) != 0) {
+        unlink(upload->spool_path);
+        free(upload);
+        server->jobs->release(server->jobs, job);
+        server->send_bad_request_response(req);
+        return;
+    }
 
-    tree->destroy(&tree);
+    Cache *cache = server->cache;
+    if (cache->fetch(cache, upload->key, upload->tmp_path) == 0) {
+        // drop what was received in favour of the cached result
+        server->logger->info_log("Cache hit", __FILE__, __LINE__);
+        unlink(upload->spool_path);
+        int status = rename(upload->tmp_path, upload->path) == 0 ? 0 : -1;
+        if (status != 0)
+            unlink(upload->tmp_path);
+        free(upload);
+        server->jobs->finish(server->jobs, job, status);
+    } else {
+        server->jobs->submit(server->jobs, job, run_upload_job, upload);
+    }
+    send_job_response(req, job);
 }
 
 /**
- * handle_download - Handle file download (Compress or Decompress)
+ * handle_status - Report the state of an upload job as JSON
  * @param server Server object
- * @param url URL
- * @param client_socket Client socket
+ * @param req The request, /status?id=<job id>
  */
-static void handle_download(Server *server, const char *const url,
-                            int client_socket)
+static void handle_status(Server *server, Request *req,
+                          const Route *route __attribute__((unused)))
+{
+    static const char *states[] = {"queued", "running", "done", "failed"};
+    const char *query = strchr(req->target, '?');
+    unsigned long long id = 0;
+    int state = -1;
+    if (query && sscanf(query, "?id=%llu", &id) == 1)
+        state = server->jobs->get_state(server->jobs, id);
+    if (state < 0) {
+        server->send_not_found_response(req);
+        return;
+    }
+
+    char body[128];
+    snprintf(body, sizeof(body), "{\"id\":%llu,\"state\":\"%s\"}", id,
+             states[state]);
+    Response resp;
+    init_response(&resp, req, "200 OK");
+    resp.add_header(&resp, "Content-Type", "application/json");
+    resp.add_header(&resp, "Cache-Control", "no-store");
+    resp.add_body(&resp, body, strlen(body));
+    resp.send(&resp, req->fd);
+}
+
+/**
+ * parse_offset - Parse the decimal offset of a byte range
+ * @param cur The text, moved past the digits
+ * @param value The parsed offset
+ * @return whether there were any digits
+ */
+static bool parse_offset(const char **cur, off_t *value)
+{
+    const char *start = *cur;
+    *value = 0;
+    for (; **cur >= '0' && **cur <= '9'; (*cur)++) {
+        // saturate, a range past the end of the file is checked later
+        if (*value < (off_t)1 << 55)
+            *value = *value * 10 + (**cur - '0');
+    }
+    return *cur != start;
+}
+
+/**
+ * parse_range - Parse a single byte range, e.g. "bytes=0-499", "bytes=500-" or
+ * "bytes=-500". Anything else, including several ranges, asks for the whole
+ * file.
+ * @param range The Range header
+ * @param size The size of the file
+ * @param start Where the range starts
+ * @param end Where the range ends, inclusive
+ * @return 1 if the range applies, 0 to send the whole file, -1 if the range
+ * lies outside the file
+ */
+static int parse_range(const char *range, off_t size, off_t *start,
+                       off_t *end)
+{
+    if (strncmp(range, "bytes=", 6) != 0)
+        return 0;
+    const char *cur = range + 6;
+    bool has_start = parse_offset(&cur, start);
+    if (*cur++ != '-')
+        return 0;
+    bool has_end = parse_offset(&cur, end);
+    if (*cur != '\0' || (!has_start && !has_end) ||
+        (has_start && has_end && *start > *end))
+        return 0;
+
+    if (!has_start) {
+        // the last *end bytes
+        if (*end == 0)
+            return -1;
+        *start = *end < size ? size - *end : 0;
+        *end = size - 1;
+    } else if (!has_end || *end >= size) {
+        *end = size - 1;
+    }
+    if (*start >= size)
+        return -1;
+    return 1;
+}
+
+/**
+ * handle_download - Send a file from downloads/, or the part of it the client
+ * asked for with a Range header
+ * @param server Server object
+ * @param req The request
+ */
+static void handle_download(Server *server, Request *req,
+                            const Route *route __attribute__((unused)))
 {
     server->logger->info_log("Handling download request", __FILE__, __LINE__);
-    char output_file[100];
-    sscanf(url, "/download?out_file=%s", output_file);
-    char download_path[100] = "downloads/";
-    strcat(download_path, output_file);
+    char output_file[100] = "";
+    char service_type[100] = "";
+    server->parse_url_params(server, req->target, output_file, service_type);
+    if (!valid_file_name(output_file)) {
+        server->send_bad_request_response(req);
+        return;
+    }
+    char download_path[PATH_LEN];
+    snprintf(download_path, sizeof(download_path), "downloads/%s",
+             output_file);
 
     server->logger->info_log("Opening file", __FILE__, __LINE__);
     server->logger->info_log(download_path, __FILE__, __LINE__);
-    FILE *file = fopen(download_path, "rb");
-    if (file == NULL) {
+    int fd = open(download_path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
         server->logger->error_log("File not found", __FILE__, __LINE__);
-        server->send_not_found_response(client_socket);
+        server->send_not_found_response(req);
+        if (fd != -1)
+            close(fd);
         return;
     }
 
-    // get file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    rewind(file);
+    off_t start = 0, end = st.st_size - 1;
+    int ranged = parse_range(req->range, st.st_size, &start, &end);
+    Response resp;
+    if (ranged < 0) {
+        init_response(&resp, req, "416 Range Not Satisfiable");
+        resp.add_header(&resp, "Content-Range", "bytes */%lld",
+                        (long long)st.st_size);
+        resp.send(&resp, req->fd);
+        close(fd);
+        return;
+    }
+    if (ranged == 0) {
+        start = 0;
+        end = st.st_size - 1;
+    }
 
     // Send HTTP Headers
     server->logger->info_log("Sending HTTP Headers", __FILE__, __LINE__);
-    char buffer[1024];
-    snprintf(buffer, sizeof(buffer),
-             "HTTP/1.1 200 OK\r\n"
-             "Access-Control-Expose-Headers: Content-Disposition\r\n"
-             "Content-Type: application/octet-stream\r\n"
-             "Content-Disposition: attachment; filename=\"%s\"\r\n"
-             "Content-Length: %ld\r\n"
-             "\r\n",
-             output_file, file_size);
-    send(client_socket, buffer, strlen(buffer), 0);
-
-    // Send the file content
-    server->logger->info_log("Sending file content", __FILE__, __LINE__);
-    while (!feof(file)) {
-        size_t read = fread(buffer, 1, sizeof(buffer), file);
-        send(client_socket, buffer, read, 0);
+    init_response(&resp, req, ranged ? "206 Partial Content" : "200 OK");
+    resp.add_header(&resp, "Access-Control-Expose-Headers",
+                    "Content-Disposition");
+    resp.add_header(&resp, "Content-Type", "application/octet-stream");
+    resp.add_header(&resp, "Content-Disposition", "attachment; filename=\"%s\"",
+                    output_file);
+    resp.add_header(&resp, "Accept-Ranges", "bytes");
+    if (ranged)
+        resp.add_header(&resp, "Content-Range", "bytes %lld-%lld/%lld",
+                        (long long)start, (long long)end,
+                        (long long)st.st_size);
+    resp.file_len = (uint64_t)(end - start + 1);
+    if (resp.send(&resp, req->fd) != 0) {
+        req->keep_alive = false;
+        close(fd);
+        return;
     }
 
-    fclose(file);
+    // Send the file content, the response is cut short if this fails
+    server->logger->info_log("Sending file content", __FILE__, __LINE__);
+    if (server->send_file(req->fd, fd, start, (size_t)(end - start + 1)) != 0)
+        req->keep_alive = false;
+    close(fd);
 }
 
 /**
- * handle_client_request - Handle client request
+ * handle_client_request - Dispatch a request to the handler of its route
  * @param server Server object
- * @param client_socket Client socket
+ * @param req The request, with its headers parsed
  */
-static void handle_client_request(Server *server, int client_socket)
+static void handle_client_request(Server *server, Request *req)
 {
     /*server->logger->info_log("Handling client request", __FILE__, __LINE__);*/
-    size_t req_len = 0;
-    char *chunk = (char *)must_calloc(INT_MAX, sizeof(char));
-    server->get_client_request(client_socket, &chunk, &req_len);
-
-    // parsing client socket header to get HTTP method, route
-    char method[100];
-    char route[100];
-    sscanf(chunk, "%s %s HTTP/1.1", method, route);
-
-    // render static file
-    if (strcmp(method, "GET") == 0) {
-        if (strncmp(route, "/download", 9) == 0) {
-            handle_download(server, route, client_socket);
-        } else {
-            char *response_data = server->handle_get_requests(server, route);
-            server->send_ok_response(client_socket, response_data);
-            free(response_data);
-        }
-    } else if (strcmp(method, "POST") == 0) {
-        if (strncmp(route, "/upload", 7) == 0) {
-            handle_upload(server, chunk, req_len);
-        } else {
-            server->send_not_found_response(client_socket);
-        }
-        server->send_ok_response(client_socket, "Done");
-    } else {
-        server->send_not_found_response(client_socket);
-    }
-    free(chunk);
+    const Route *route =
+        server->router->match(server->router, req->method, req->target);
+    if (route)
+        route->handler(server, req, route);
+    else
+        server->send_template(req, server->handle_get_requests(server, NULL));
 }
 
 /**
@@ -199,30 +577,20 @@ static void server_mode(Config *config __attribute__((unused)))
 {
     // setup server
     Server *server;
-    init_server(&server, 8000);
+    init_server(&server, SERVER_PORT);
     server->logger->info_log("Starting server mode", __FILE__, __LINE__);
+    Router *router = server->router;
+    router->add_route(router, "GET", "/download", false, handle_download, NULL);
+    router->add_route(router, "GET", "/status", false, handle_status, NULL);
+    router->add_route(router, "POST", "/upload", false, handle_upload, NULL);
     server->config_router(server);
+    mkdir("downloads", 0755);
+    server->cache = new_cache(CACHE_DIR, CACHE_LIMIT);
+    server->jobs = new_job_queue(JOB_WORKERS, MAX_UPLOAD_JOBS);
 
     // list routes
-    server->router->list_routes(server->router->root);
-    while (1) {
-        int client_socket = accept(server->socket, NULL, NULL);
-        if (client_socket == -1) {
-            continue;
-        }
-
-        // fork a child process to handle client request
-        pid_t pid = fork();
-        if (pid == 0) {
-            // child process
-            close(server->socket);
-            handle_client_request(server, client_socket);
-            close(client_socket);
-            exit(0);
-        } else {
-            close(client_socket);
-        }
-    }
+    router->list_routes(router);
+    server->run(server, handle_client_request, SERVER_WORKERS);
 }
 
 /**
@@ -237,6 +605,7 @@ int main(const int argc, const char **argv)
     typedef void (*mode_func)(Config *);
     autofree_config Config *config = new_config(argc, argv + 1);
     mode_func mode_funcs[] = {cli_mode, server_mode};
+    set_log_level(config->log_level);
     mode_funcs[config->using_server](config);
     return 0;
 }
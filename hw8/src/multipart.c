@@ -0,0 +1,255 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../include/multipart.h"
+#include "../include/utils.h"
+#include <string.h>
+#include <strings.h>
+#define MULTIPART_BUFFER_SIZE 65536
+#define MAX_PART_HEADER_SIZE 8192
+
+enum MULTIPART_STATE {
+    PART_PREAMBLE,  // anything before the first delimiter
+    PART_DELIMITER, // "--" or "\r\n" right after a delimiter
+    PART_HEADERS,   // the headers of a part
+    PART_BODY,      // the data of a part
+    PART_DONE       // anything after the closing delimiter
+};
+
+/**
+ * search - Find the delimiter with Boyer-Moore-Horspool
+ * @param self The parser
+ * @return where the delimiter starts in the buffer, self->len if it is not
+ * there
+ */
+static size_t search(const MultipartParser *self)
+{
+    const size_t m = self->delimiter_len;
+    const unsigned char *hay = (const unsigned char *)self->buf;
+    for (size_t i = 0; i + m <= self->len; i += self->skip[hay[i + m - 1]]) {
+        size_t j = m - 1;
+        while (hay[i + j] == (unsigned char)self->delimiter[j]) {
+            if (j == 0)
+                return i;
+            j--;
+        }
+    }
+    return self->len;
+}
+
+/**
+ * consume - Drop bytes from the front of the buffer
+ * @param self The parser
+ * @param len The number of bytes
+ */
+static void consume(MultipartParser *self, size_t len)
+{
+    memmove(self->buf, self->buf + len, self->len - len);
+    self->len -= len;
+}
+
+/**
+ * get_param - Copy a parameter of a header, e.g. name="x"
+ * @param header The header value
+ * @param end The end of the header
+ * @param key The parameter name
+ * @param out Where to store the value, MAX_PART_NAME_LEN long
+ */
+static void get_param(const char *header, const char *end, const char *key,
+                      char *out)
+{
+    size_t key_len = strlen(key);
+    out[0] = '\0';
+    for (const char *cur = header; cur < end; cur++) {
+        // every parameter follows a ';' and optional spaces
+        if (*cur != ';')
+            continue;
+        do
+            cur++;
+        while (cur < end && (*cur == ' ' || *cur == '\t'));
+        if ((size_t)(end - cur) <= key_len ||
+            strncasecmp(cur, key, key_len) != 0 || cur[key_len] != '=')
+            continue;
+
+        const char *value = cur + key_len + 1;
+        const char *value_end;
+        if (value < end && *value == '"') {
+            value++;
+            value_end = memchr(value, '"', (size_t)(end - value));
+            value_end = value_end ? value_end : end;
+        } else {
+            for (value_end = value; value_end < end && *value_end != ';';)
+                value_end++;
+        }
+        size_t len = (size_t)(value_end - value);
+        len = len < MAX_PART_NAME_LEN ? len : MAX_PART_NAME_LEN - 1;
+        memcpy(out, value, len);
+        out[len] = '\0';
+        return;
+    }
+}
+
+/**
+ * begin_part - Parse the headers of a part and announce it
+ * @param self The parser
+ * @param headers_len The length of the headers without the blank line
+ * @return the callback's result
+ */
+static int begin_part(MultipartParser *self, size_t headers_len)
+{
+    static const char name[] = "Content-Disposition:";
+    char field[MAX_PART_NAME_LEN] = "";
+    char filename[MAX_PART_NAME_LEN] = "";
+    const char *cur = self->buf, *end = self->buf + headers_len;
+    while (cur < end) {
+        const char *eol = memchr(cur, '\r', (size_t)(end - cur));
+        eol = eol ? eol : end;
+        if ((size_t)(eol - cur) >= sizeof(name) - 1 &&
+            strncasecmp(cur, name, sizeof(name) - 1) == 0) {
+            get_param(cur, eol, "name", field);
+            get_param(cur, eol, "filename", filename);
+        }
+        cur = eol + 2;
+    }
+    return self->on_part_begin(self->ctx, field, filename);
+}
+
+/**
+ * process - Parse as much of the buffer as possible
+ * @param self The parser
+ * @return 0 on success, -1 if the body is malformed or a callback stopped
+ */
+static int process(MultipartParser *self)
+{
+    while (true) {
+        switch (self->state) {
+        case PART_PREAMBLE:
+        case PART_BODY: {
+            size_t found = search(self);
+            size_t keep = self->delimiter_len - 1;
+            size_t data_len = found < self->len ? found
+                              : self->len > keep ? self->len - keep
+                                                 : 0;
+            if (self->state == PART_BODY && data_len > 0 &&
+                self->on_part_data(self->ctx, self->buf, data_len) != 0)
+                return -1;
+            if (found == self->len) {
+                // the tail may still be the start of a delimiter
+                consume(self, data_len);
+                return 0;
+            }
+            consume(self, found + self->delimiter_len);
+            self->state = PART_DELIMITER;
+            continue;
+        }
+        case PART_DELIMITER:
+            if (self->len < 2)
+                return 0;
+            if (memcmp(self->buf, "--", 2) == 0) {
+                self->state = PART_DONE;
+                self->done = true;
+            } else if (memcmp(self->buf, "\r\n", 2) == 0) {
+                self->state = PART_HEADERS;
+            } else {
+                return -1;
+            }
+            consume(self, 2);
+            continue;
+        case PART_HEADERS: {
+            // a part without headers starts with the blank line right away
+            size_t headers_len = 0;
+            if (self->len >= 2 && memcmp(self->buf, "\r\n", 2) == 0) {
+                headers_len = 0;
+            } else {
+                size_t i = 0;
+                while (i + 4 <= self->len &&
+                       memcmp(self->buf + i, "\r\n\r\n", 4) != 0)
+                    i++;
+                if (i + 4 > self->len)
+                    return self->len > MAX_PART_HEADER_SIZE ? -1 : 0;
+                headers_len = i + 2;
+            }
+            if (begin_part(self, headers_len) != 0)
+                return -1;
+            consume(self, headers_len + 2);
+            self->state = PART_BODY;
+            continue;
+        }
+        default:
+            self->len = 0;
+            return 0;
+        }
+    }
+}
+
+/**
+ * feed - Parse the next bytes of the body
+ * @param self The parser
+ * @param data The next bytes of the body
+ * @param len The number of bytes
+ * @return 0 on success, -1 if the body is malformed or a callback stopped
+ */
+static int feed(MultipartParser *self, const char *data, size_t len)
+{
+    while (len > 0) {
+        size_t n = self->cap - self->len < len ? self->cap - self->len : len;
+        memcpy(self->buf + self->len, data, n);
+        self->len += n;
+        data += n;
+        len -= n;
+        if (process(self) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * destroy - Free the parser
+ * @param self The parser
+ */
+static void destroy(MultipartParser **self)
+{
+    if (!self || !*self)
+        return;
+    free((*self)->buf);
+    free(*self);
+    *self = NULL;
+}
+
+MultipartParser *new_multipart_parser(const char *content_type,
+                                      PartBegin on_part_begin,
+                                      PartData on_part_data, void *ctx)
+{
+    // multipart/form-data; boundary=<1 to 70 characters, maybe quoted>
+    static const char type[] = "multipart/form-data";
+    if (strncasecmp(content_type, type, sizeof(type) - 1) != 0)
+        return NULL;
+    char boundary[MAX_PART_NAME_LEN];
+    const char *params = content_type + sizeof(type) - 1;
+    get_param(params, params + strlen(params), "boundary", boundary);
+    size_t boundary_len = strlen(boundary);
+    if (boundary_len == 0 || boundary_len > MAX_BOUNDARY_LEN)
+        return NULL;
+
+    MultipartParser *self = must_calloc(1, sizeof(MultipartParser));
+    memcpy(self->delimiter, "\r\n--", 4);
+    memcpy(self->delimiter + 4, boundary, boundary_len);
+    self->delimiter_len = boundary_len + 4;
+    memset(self->skip, (int)self->delimiter_len, sizeof(self->skip));
+    for (size_t i = 0; i + 1 < self->delimiter_len; i++)
+        self->skip[(unsigned char)self->delimiter[i]] =
+            (uint8_t)(self->delimiter_len - 1 - i);
+
+    // the body may open with the first delimiter, so pretend a line break
+    // came before it
+    self->cap = MULTIPART_BUFFER_SIZE + MAX_PART_HEADER_SIZE;
+    self->buf = must_calloc(self->cap, sizeof(char));
+    memcpy(self->buf, "\r\n", 2);
+    self->len = 2;
+    self->state = PART_PREAMBLE;
+    self->done = false;
+    self->on_part_begin = on_part_begin;
+    self->on_part_data = on_part_data;
+    self->ctx = ctx;
+    self->feed = &feed;
+    self->destroy = &destroy;
+    return self;
+}
@@ -3,20 +3,32 @@
 
 /**
  * Create a new node with the given data
+ * @param arena The arena to take the node from
  * @param data The data to be stored in the node
- * @return The new node
+ * @return The new node, NULL if the arena is full
  */
-Node *create_node(char data)
+Node *create_node(NodeArena *arena, char data)
 {
-    Node *newnode = must_calloc(1, sizeof(Node));
+    if (arena->len == MAX_NODE_NUM)
+        return NULL;
+    Node *newnode = &arena->nodes[arena->len++];
     newnode->data = data;
     newnode->freq = 1;
-    newnode->p = 0;
-    newnode->left = NULL;
-    newnode->right = NULL;
+    newnode->p = NO_NODE;
+    newnode->left = NO_NODE;
+    newnode->right = NO_NODE;
     return newnode;
 }
 
+/**
+ * Release every node of an arena at once
+ * @param arena The arena
+ */
+void reset_arena(NodeArena *arena)
+{
+    arena->len = 0;
+}
+
 /**
  * Initialize an array of nodes to NULL
  * @param arr The array of nodes
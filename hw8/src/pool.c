@@ -0,0 +1,117 @@
+#include "../include/pool.h"
+#include "../include/utils.h"
+#include <stdio.h>
+
+/**
+ * worker - Run queued tasks until the pool is stopped and drained
+ * @param arg The thread pool
+ */
+static void *worker(void *arg)
+{
+    ThreadPool *self = arg;
+    while (true) {
+        pthread_mutex_lock(&self->lock);
+        while (self->len == 0 && !self->stopping)
+            pthread_cond_wait(&self->not_empty, &self->lock);
+        if (self->len == 0) {
+            pthread_mutex_unlock(&self->lock);
+            return NULL;
+        }
+
+        PoolTask task = self->tasks[self->head];
+        self->head = (self->head + 1) % self->capacity;
+        self->len--;
+        pthread_cond_signal(&self->not_full);
+        pthread_mutex_unlock(&self->lock);
+
+        task.func(task.arg);
+    }
+}
+
+/**
+ * submit - Queue a task, waiting while the queue is full
+ * @param self The thread pool
+ * @param func The task to run on a worker
+ * @param arg The argument passed to the task
+ */
+static void submit(ThreadPool *self, Task func, void *arg)
+{
+    pthread_mutex_lock(&self->lock);
+    while (self->len == self->capacity)
+        pthread_cond_wait(&self->not_full, &self->lock);
+    self->tasks[(self->head + self->len++) % self->capacity] =
+        (PoolTask){.func = func, .arg = arg};
+    pthread_cond_signal(&self->not_empty);
+    pthread_mutex_unlock(&self->lock);
+}
+
+/**
+ * try_submit - Queue a task unless the queue is full
+ * @param self The thread pool
+ * @param func The task to run on a worker
+ * @param arg The argument passed to the task
+ * @return true if the task was queued
+ */
+static bool try_submit(ThreadPool *self, Task func, void *arg)
+{
+    pthread_mutex_lock(&self->lock);
+    bool queued = self->len < self->capacity;
+    if (queued) {
+        self->tasks[(self->head + self->len++) % self->capacity] =
+            (PoolTask){.func = func, .arg = arg};
+        pthread_cond_signal(&self->not_empty);
+    }
+    pthread_mutex_unlock(&self->lock);
+    return queued;
+}
+
+/**
+ * destroy - Run the queued tasks to completion, stop the workers and free the
+ * pool
+ * @param self The thread pool
+ */
+static void destroy(ThreadPool **self)
+{
+    if (!self || !*self)
+        return;
+
+    pthread_mutex_lock(&(*self)->lock);
+    (*self)->stopping = true;
+    pthread_cond_broadcast(&(*self)->not_empty);
+    pthread_mutex_unlock(&(*self)->lock);
+    for (size_t i = 0; i < (*self)->thread_num; i++)
+        pthread_join((*self)->threads[i], NULL);
+
+    pthread_mutex_destroy(&(*self)->lock);
+    pthread_cond_destroy(&(*self)->not_empty);
+    pthread_cond_destroy(&(*self)->not_full);
+    free((*self)->threads);
+    free((*self)->tasks);
+    free(*self);
+    *self = NULL;
+}
+
+ThreadPool *new_thread_pool(size_t thread_num, size_t capacity)
+{
+    ThreadPool *self = must_calloc(1, sizeof(ThreadPool));
+    self->thread_num = thread_num;
+    self->capacity = capacity;
+    self->head = self->len = 0;
+    self->stopping = false;
+    self->tasks = must_calloc(capacity, sizeof(PoolTask));
+    self->threads = must_calloc(thread_num, sizeof(pthread_t));
+    self->submit = &submit;
+    self->try_submit = &try_submit;
+    self->destroy = &destroy;
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->not_empty, NULL);
+    pthread_cond_init(&self->not_full, NULL);
+
+    for (size_t i = 0; i < thread_num; i++) {
+        if (pthread_create(&self->threads[i], NULL, worker, self) != 0) {
+            perror("Error creating thread");
+            exit(1);
+        }
+    }
+    return self;
+}
@@ -0,0 +1,437 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../include/request.h"
+#include "../include/utils.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#define REQUEST_BUFFER_SIZE 8192
+#define MAX_CHUNK_LINE 1024
+#define LINGER_TIMEOUT 1 // seconds to wait for the rest of a body
+#define MAX_LINGER_SIZE (1 << 20) // bytes dropped before giving up
+
+enum BODY_STATE {
+    BODY_LENGTH,     // Content-Length bytes of body
+    BODY_CHUNK_SIZE, // the size line of the next chunk
+    BODY_CHUNK_DATA, // the data of a chunk
+    BODY_CHUNK_END,  // the CRLF after the data of a chunk
+    BODY_TRAILER,    // trailer lines up to the blank line
+    BODY_DONE,
+    BODY_ERROR // the framing is lost, the connection cannot be reused
+};
+
+/**
+ * trim - Strip the spaces around a header value
+ * @param start The start of the value, moved past leading spaces
+ * @param end The end of the value, moved before trailing spaces
+ */
+static void trim(const char **start, const char **end)
+{
+    while (*start < *end && (**start == ' ' || **start == '\t'))
+        (*start)++;
+    while (*end > *start && ((*end)[-1] == ' ' || (*end)[-1] == '\t'))
+        (*end)--;
+}
+
+/**
+ * is_header - Check the name of a header line, ignoring case
+ * @param line The header line
+ * @param line_len The length of the line
+ * @param name The header name followed by a colon
+ * @return whether the line is that header
+ */
+static bool is_header(const char *line, size_t line_len, const char *name)
+{
+    size_t name_len = strlen(name);
+    return line_len >= name_len && strncasecmp(line, name, name_len) == 0;
+}
+
+/**
+ * parse_length - Parse a decimal Content-Length value
+ * @param start The start of the value
+ * @param end The end of the value
+ * @param value The parsed length
+ * @return 0 on success, -1 if the value is not a plain number
+ */
+static int parse_length(const char *start, const char *end, uint64_t *value)
+{
+    if (start == end)
+        return -1;
+    uint64_t len = 0;
+    for (; start < end; start++) {
+        if (*start < '0' || *start > '9' || len > (UINT64_MAX - 9) / 10)
+            return -1;
+        len = len * 10 + (uint64_t)(*start - '0');
+    }
+    *value = len;
+    return 0;
+}
+
+/**
+ * has_token - Look for a token in a comma separated header value
+ * @param start The start of the value
+ * @param end The end of the value
+ * @param token The token, e.g. "close"
+ * @return whether the value lists the token, ignoring case
+ */
+static bool has_token(const char *start, const char *end, const char *token)
+{
+    size_t token_len = strlen(token);
+    while (start < end) {
+        const char *comma = memchr(start, ',', (size_t)(end - start));
+        const char *item = start, *item_end = comma ? comma : end;
+        trim(&item, &item_end);
+        if ((size_t)(item_end - item) == token_len &&
+            strncasecmp(item, token, token_len) == 0)
+            return true;
+        start = comma ? comma + 1 : end;
+    }
+    return false;
+}
+
+/**
+ * parse_request_line - Parse "<method> <target> HTTP/1.x"
+ * @param self The request
+ * @param line The request line
+ * @param end The end of the line
+ * @return 0 on success, -1 if the line is malformed
+ */
+static int parse_request_line(Request *self, const char *line,
+                              const char *end)
+{
+    const char *method_end = memchr(line, ' ', (size_t)(end - line));
+    if (!method_end || method_end == line ||
+        (size_t)(method_end - line) >= MAX_METHOD_LEN)
+        return -1;
+    const char *target = method_end + 1;
+    const char *target_end = memchr(target, ' ', (size_t)(end - target));
+    if (!target_end || target_end == target ||
+        (size_t)(target_end - target) >= MAX_TARGET_LEN ||
+        end - target_end - 1 != 8 || strncmp(target_end + 1, "HTTP/1.", 7))
+        return -1;
+
+    memcpy(self->method, line, (size_t)(method_end - line));
+    self->method[method_end - line] = '\0';
+    memcpy(self->target, target, (size_t)(target_end - target));
+    self->target[target_end - target] = '\0';
+    // HTTP/1.1 connections are persistent unless the client says otherwise
+    self->keep_alive = target_end[8] == '1';
+    return 0;
+}
+
+size_t find_header_end(const char *buf, size_t from, size_t len)
+{
+    for (size_t i = from; i + 4 <= len; i++) {
+        if (buf[i] == '\r' && memcmp(buf + i, "\r\n\r\n", 4) == 0)
+            return i + 4;
+    }
+    return 0;
+}
+
+/**
+ * receive - Block until the client sends more data
+ * @param self The request
+ * @param out Where to store the data
+ * @param out_len The size of out
+ * @return the number of bytes received, -1 if the client stopped sending
+ */
+static ssize_t receive(Request *self, char *out, size_t out_len)
+{
+    // the client holds the body back until we accept it
+    if (self->expect_continue) {
+        static const char msg[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        self->expect_continue = false;
+        send(self->fd, msg, sizeof(msg) - 1, 0);
+    }
+
+    while (true) {
+        ssize_t size_recv = recv(self->fd, out, out_len, 0);
+        if (size_recv == -1 && errno == EINTR)
+            continue;
+        return size_recv > 0 ? size_recv : -1;
+    }
+}
+
+/**
+ * read_line - Read a line of the chunked framing
+ * @param self The request
+ * @param line_len The length of the line without its line break
+ * @return the line, NULL if it is too long or the client stopped sending
+ */
+static const char *read_line(Request *self, size_t *line_len)
+{
+    while (true) {
+        char *start = self->buf + self->pos;
+        char *eol = memchr(start, '\n', self->len - self->pos);
+        if (eol) {
+            self->pos = (size_t)(eol - self->buf) + 1;
+            bool has_cr = eol > start && eol[-1] == '\r';
+            *line_len = (size_t)(eol - start) - has_cr;
+            return start;
+        }
+        if (self->len - self->pos > MAX_CHUNK_LINE)
+            return NULL;
+
+        // keep the partial line and make room behind it
+        memmove(self->buf, start, self->len - self->pos);
+        self->len -= self->pos;
+        self->pos = 0;
+        if (self->cap < self->len + REQUEST_BUFFER_SIZE + 1) {
+            self->cap = self->len + REQUEST_BUFFER_SIZE + 1;
+            char *buf = realloc(self->buf, self->cap);
+            if (!buf)
+                return NULL;
+            self->buf = buf;
+        }
+        ssize_t size_recv = receive(self, self->buf + self->len,
+                                    self->cap - self->len - 1);
+        if (size_recv < 0)
+            return NULL;
+        self->len += (size_t)size_recv;
+        self->buf[self->len] = '\0';
+    }
+}
+
+/**
+ * parse_chunk_size - Parse the hex size of a chunk, ignoring extensions
+ * @param line The size line
+ * @param line_len The length of the line
+ * @param size The size of the chunk
+ * @return 0 on success, -1 if the line is malformed
+ */
+static int parse_chunk_size(const char *line, size_t line_len, uint64_t *size)
+{
+    size_t i = 0;
+    *size = 0;
+    for (; i < line_len; i++) {
+        char c = line[i];
+        unsigned digit;
+        if (c >= '0' && c <= '9')
+            digit = (unsigned)(c - '0');
+        else if (c >= 'a' && c <= 'f')
+            digit = (unsigned)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            digit = (unsigned)(c - 'A' + 10);
+        else
+            break;
+        if (*size >> 60)
+            return -1;
+        *size = *size << 4 | digit;
+    }
+    return i > 0 && (i == line_len || line[i] == ';' || line[i] == ' ') ? 0
+                                                                         : -1;
+}
+
+/**
+ * decode_body - Decode the next part of the body from its framing
+ * @param self The request
+ * @param out Where to store the body bytes
+ * @param out_len The size of out
+ * @return the number of bytes read, 0 at the end of the body, -1 if the body
+ * is malformed or the client stops sending
+ */
+static ssize_t decode_body(Request *self, char *out, size_t out_len)
+{
+    const char *line;
+    size_t line_len;
+    while (true) {
+        switch (self->body_state) {
+        case BODY_LENGTH:
+        case BODY_CHUNK_DATA: {
+            if (self->remaining == 0) {
+                self->body_state = self->body_state == BODY_LENGTH
+                                       ? BODY_DONE
+                                       : BODY_CHUNK_END;
+                continue;
+            }
+
+            // hand out buffered bytes first, then receive straight into out
+            size_t want =
+                self->remaining < out_len ? (size_t)self->remaining : out_len;
+            ssize_t size_read;
+            if (self->pos < self->len) {
+                size_read = (ssize_t)(self->len - self->pos < want
+                                          ? self->len - self->pos
+                                          : want);
+                memcpy(out, self->buf + self->pos, (size_t)size_read);
+                self->pos += (size_t)size_read;
+            } else if ((size_read = receive(self, out, want)) < 0) {
+                return -1;
+            }
+            self->remaining -= (uint64_t)size_read;
+            return size_read;
+        }
+        case BODY_CHUNK_SIZE:
+            if (!(line = read_line(self, &line_len)) ||
+                parse_chunk_size(line, line_len, &self->remaining) != 0)
+                return -1;
+            self->body_state =
+                self->remaining ? BODY_CHUNK_DATA : BODY_TRAILER;
+            continue;
+        case BODY_CHUNK_END:
+            if (!(line = read_line(self, &line_len)) || line_len != 0)
+                return -1;
+            self->body_state = BODY_CHUNK_SIZE;
+            continue;
+        case BODY_TRAILER:
+            if (!(line = read_line(self, &line_len)))
+                return -1;
+            if (line_len == 0)
+                self->body_state = BODY_DONE;
+            continue;
+        case BODY_DONE:
+            return 0;
+        default:
+            return -1;
+        }
+    }
+}
+
+/**
+ * read_body - Read the next part of the body, decoding chunked framing
+ * @param self The request
+ * @param out Where to store the body bytes
+ * @param out_len The size of out
+ * @return the number of bytes read, 0 at the end of the body, -1 if the body
+ * is malformed or the client stops sending
+ */
+static ssize_t read_body(Request *self, char *out, size_t out_len)
+{
+    ssize_t size_read = decode_body(self, out, out_len);
+    // a failed read may leave part of a line or chunk behind
+    if (size_read < 0)
+        self->body_state = BODY_ERROR;
+    return size_read;
+}
+
+/**
+ * skip_body - Read and drop what is left of the body
+ * @param self The request
+ * @return 0 on success, -1 if the body is malformed or the client stops
+ * sending
+ */
+static int skip_body(Request *self)
+{
+    // the client has not sent a body nobody asked for, so do not invite it
+    if (self->expect_continue)
+        return -1;
+    char scratch[REQUEST_BUFFER_SIZE];
+    ssize_t size_read;
+    while ((size_read = read_body(self, scratch, sizeof(scratch))) > 0)
+        ;
+    return size_read == 0 ? 0 : -1;
+}
+
+/**
+ * reusable - Tell whether the connection can carry another request
+ * @param self The request
+ * @return false if the client closes it, the body was never invited or its
+ * framing is lost
+ */
+static bool reusable(const Request *self)
+{
+    return self->keep_alive && !self->expect_continue &&
+           self->body_state != BODY_ERROR;
+}
+
+/**
+ * discard_body - Stop sending and drop what the client still sends before
+ * the connection is closed
+ * @param self The request
+ */
+static void discard_body(Request *self)
+{
+    bool done = self->body_state == BODY_DONE ||
+                (self->body_state == BODY_LENGTH && self->remaining == 0);
+    if (done)
+        return;
+    shutdown(self->fd, SHUT_WR);
+    struct timeval timeout = {.tv_sec = LINGER_TIMEOUT, .tv_usec = 0};
+    setsockopt(self->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    // recv directly, receive would invite a body that is not wanted
+    char scratch[REQUEST_BUFFER_SIZE];
+    for (size_t dropped = 0; dropped < MAX_LINGER_SIZE;) {
+        ssize_t size_recv = recv(self->fd, scratch, sizeof(scratch), 0);
+        if (size_recv == -1 && errno == EINTR)
+            continue;
+        if (size_recv <= 0)
+            break;
+        dropped += (size_t)size_recv;
+    }
+    self->body_state = BODY_DONE;
+}
+
+int init_request(Request *self, size_t header_len)
+{
+    self->content_len = 0;
+    self->chunked = false;
+    self->expect_continue = false;
+    self->content_type[0] = '\0';
+    self->range[0] = '\0';
+    self->read_body = &read_body;
+    self->skip_body = &skip_body;
+    self->reusable = &reusable;
+    self->discard_body = &discard_body;
+    self->body_state = BODY_ERROR; // until the headers are parsed
+
+    // header_len includes the blank line, so every line ends in '\n'
+    const char *cur = self->buf, *end = self->buf + header_len;
+    const char *eol = memchr(cur, '\n', (size_t)(end - cur));
+    const char *line_end = eol > cur && eol[-1] == '\r' ? eol - 1 : eol;
+    if (parse_request_line(self, cur, line_end) != 0)
+        return -1;
+
+    bool has_length = false;
+    for (cur = eol + 1; cur < end; cur = eol + 1) {
+        eol = memchr(cur, '\n', (size_t)(end - cur));
+        line_end = eol > cur && eol[-1] == '\r' ? eol - 1 : eol;
+        size_t line_len = (size_t)(line_end - cur);
+        if (line_len == 0)
+            break;
+        const char *colon = memchr(cur, ':', line_len);
+        if (!colon)
+            return -1;
+        const char *value = colon + 1, *value_end = line_end;
+        trim(&value, &value_end);
+        size_t value_len = (size_t)(value_end - value);
+
+        if (is_header(cur, line_len, "Content-Length:")) {
+            uint64_t len;
+            if (parse_length(value, value_end, &len) != 0 ||
+                (has_length && len != self->content_len))
+                return -1;
+            self->content_len = len;
+            has_length = true;
+        } else if (is_header(cur, line_len, "Transfer-Encoding:")) {
+            // chunked must be the last coding and we support no other
+            if (value_len != 7 || strncasecmp(value, "chunked", 7) != 0)
+                return -1;
+            self->chunked = true;
+        } else if (is_header(cur, line_len, "Content-Type:")) {
+            if (value_len >= MAX_HEADER_VALUE_LEN)
+                return -1;
+            memcpy(self->content_type, value, value_len);
+            self->content_type[value_len] = '\0';
+        } else if (is_header(cur, line_len, "Range:")) {
+            // an oversized range is ignored and the whole file is sent
+            if (value_len < MAX_HEADER_VALUE_LEN) {
+                memcpy(self->range, value, value_len);
+                self->range[value_len] = '\0';
+            }
+        } else if (is_header(cur, line_len, "Expect:")) {
+            self->expect_continue =
+                value_len == 12 && strncasecmp(value, "100-continue", 12) == 0;
+        } else if (is_header(cur, line_len, "Connection:")) {
+            if (has_token(value, value_end, "close"))
+                self->keep_alive = false;
+        }
+    }
+
+    // a chunked body ignores Content-Length
+    self->pos = header_len;
+    self->body_state = self->chunked ? BODY_CHUNK_SIZE : BODY_LENGTH;
+    self->remaining = self->chunked ? 0 : self->content_len;
+    return 0;
+}
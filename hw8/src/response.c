@@ -0,0 +1,131 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../include/response.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/**
+ * append - Append formatted text to the head
+ * @param self The response
+ * @param format The format of the text
+ * @param args The values to format
+ */
+static void append(Response *self, const char *format, va_list args)
+{
+    size_t room = MAX_RESPONSE_HEAD - self->head_len;
+    int len = vsnprintf(self->head + self->head_len, room, format, args);
+    if (len < 0 || (size_t)len >= room)
+        self->overflow = true;
+    else
+        self->head_len += (size_t)len;
+}
+
+/**
+ * append_text - Append formatted text to the head
+ * @param self The response
+ * @param format The format of the text
+ */
+static void append_text(Response *self, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+static void append_text(Response *self, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    append(self, format, args);
+    va_end(args);
+}
+
+/**
+ * add_header - Add a header, the value is formatted like printf
+ * @param self The response
+ * @param name The header name
+ * @param format The format of the value
+ */
+static void add_header(Response *self, const char *name, const char *format,
+                       ...)
+{
+    va_list args;
+    append_text(self, "%s: ", name);
+    va_start(args, format);
+    append(self, format, args);
+    va_end(args);
+    append_text(self, "\r\n");
+}
+
+/**
+ * add_body - Add a part of the body without copying it
+ * @param self The response
+ * @param data The body part
+ * @param len The length of the part
+ */
+static void add_body(Response *self, const void *data, size_t len)
+{
+    if (self->part_num == MAX_RESPONSE_PARTS) {
+        self->overflow = true;
+        return;
+    }
+    self->parts[self->part_num++] =
+        (struct iovec){.iov_base = (void *)data, .iov_len = len};
+    self->content_len += len;
+}
+
+/**
+ * send_response - Finish the headers and send the head and the body parts
+ * with one gather write, picking up where the socket cut a write short
+ * @param self The response
+ * @param fd The socket
+ * @return 0 on success, -1 if the response did not fit or the client stopped
+ * receiving
+ */
+static int send_response(Response *self, int fd)
+{
+    if (self->close)
+        append_text(self, "Connection: close\r\n");
+    append_text(self, "Content-Length: %llu\r\n\r\n",
+                (unsigned long long)(self->content_len + self->file_len));
+    if (self->overflow)
+        return -1;
+    self->parts[0] =
+        (struct iovec){.iov_base = self->head, .iov_len = self->head_len};
+
+    // hold the last segment back while the caller still has a file to send
+    int flags = self->file_len ? MSG_MORE : 0;
+    struct msghdr msg = {.msg_iov = self->parts,
+                         .msg_iovlen = (size_t)self->part_num};
+    while (msg.msg_iovlen > 0) {
+        ssize_t size_sent = sendmsg(fd, &msg, flags);
+        if (size_sent == -1 && errno == EINTR)
+            continue;
+        if (size_sent <= 0)
+            return -1;
+
+        // skip the parts that went out and trim the one cut short
+        size_t left = (size_t)size_sent;
+        while (msg.msg_iovlen > 0 && left >= msg.msg_iov->iov_len) {
+            left -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + left;
+            msg.msg_iov->iov_len -= left;
+        }
+    }
+    return 0;
+}
+
+void init_response(Response *self, const Request *req, const char *status)
+{
+    self->head_len = 0;
+    self->overflow = false;
+    self->part_num = 1; // parts[0] is the head, filled in when sending
+    self->content_len = 0;
+    self->file_len = 0;
+    self->close = !req->reusable(req);
+    self->add_header = &add_header;
+    self->add_body = &add_body;
+    self->send = &send_response;
+    append_text(self, "HTTP/1.1 %s\r\n", status);
+}
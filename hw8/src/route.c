@@ -1,82 +1,160 @@
 #include "../include/route.h"
+#include "../include/utils.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#define FNV_OFFSET 0xcbf29ce484222325
+#define FNV_PRIME 0x100000001b3
 
 /**
- * init_route - Initialize a new route
- * @param endpoint uri
- * @param template the template file to render for the endpoint
- * @return Route object
+ * hash_method - Start the hash of a route with its method
+ * @param method The request method
+ * @return the FNV-1a hash of the method and a separator
  */
-static Route *init_route(char *key, char *value)
+static uint64_t hash_method(const char *method)
 {
-    Route *new_route = (Route *)malloc(sizeof(Route));
-
-    new_route->key = key;
-    new_route->value = value;
-    new_route->left = new_route->right = NULL;
-    return new_route;
+    uint64_t hash = FNV_OFFSET;
+    for (; *method; method++)
+        hash = (hash ^ (uint8_t)*method) * FNV_PRIME;
+    return (hash ^ ' ') * FNV_PRIME;
 }
 
 /**
- * list_routes - List all the routes in the router
- * @param root Root node of the router
+ * add_route - Add a new route to the router
+ * @param self The router
+ * @param method The request method
+ * @param path The path, without a query string
+ * @param prefix Whether the route also matches the paths below path
+ * @param handler The handler of the route
+ * @param value What the handler serves, may be NULL
  */
-static void list_routes(Route *root)
+static void add_route(Router *self, const char *method, const char *path,
+                      bool prefix, RouteHandler handler, const char *value)
 {
+    for (size_t i = 0; i < self->route_num; i++) {
+        Route *route = &self->routes[i];
+        if (strcmp(route->method, method) == 0 &&
+            strcmp(route->path, path) == 0 && route->prefix == prefix) {
+            printf("============ WARNING ============\n");
+            printf("A Route For \"%s %s\" Already Exists\n", method, path);
+            return;
+        }
+    }
+    if (strlen(method) >= MAX_METHOD_LEN) {
+        printf("Invalid method \"%s\"\n", method);
+        return;
+    }
 
-    if (root != NULL) {
-        list_routes(root->left);
-        printf("%s -> %s \n", root->key, root->value);
-        list_routes(root->right);
+    if (self->route_num == self->route_cap) {
+        self->route_cap = self->route_cap ? self->route_cap * 2 : 8;
+        Route *routes = realloc(self->routes, self->route_cap * sizeof(Route));
+        if (!routes) {
+            printf("Failed to allocate memory for router\n");
+            exit(1);
+        }
+        self->routes = routes;
     }
+    Route *route = &self->routes[self->route_num++];
+    strcpy(route->method, method);
+    route->path = path;
+    route->path_len = strlen(path);
+    route->prefix = prefix;
+    route->handler = handler;
+    route->value = value;
+    route->next = NULL;
+
+    uint64_t hash = hash_method(method);
+    for (size_t i = 0; i < route->path_len; i++)
+        hash = (hash ^ (uint8_t)path[i]) * FNV_PRIME;
+    route->hash = hash;
 }
 
 /**
- * add_route - Add a new route to the router
- * @param root Root node of the router
- * @param endpoint uri
- * @param template the template file to render for the endpoint
- * @return Route object
+ * compile - Build the hash table of the routes, at most half full
+ * @param self The router
  */
-static void add_route(Route **root, char *key, char *value)
+static void compile(Router *self)
 {
-    if (*root == NULL) {
-        *root = init_route(key, value);
-        return;
+    size_t bucket_num = 16;
+    while (bucket_num < self->route_num * 2)
+        bucket_num *= 2;
+    free(self->buckets);
+    self->buckets = must_calloc(bucket_num, sizeof(Route *));
+    self->bucket_num = bucket_num;
+    for (size_t i = 0; i < self->route_num; i++) {
+        Route *route = &self->routes[i];
+        Route **bucket = &self->buckets[route->hash & (bucket_num - 1)];
+        route->next = *bucket;
+        *bucket = route;
     }
+}
 
-    if (strcmp(key, (*root)->key) == 0) {
-        printf("============ WARNING ============\n");
-        printf("A Route For \"%s\" Already Exists\n", key);
-    } else if (strcmp(key, (*root)->key) > 0) {
-        add_route(&(*root)->right, key, value);
-    } else {
-        add_route(&(*root)->left, key, value);
+/**
+ * find - Look up a route in the hash table
+ * @param self The router
+ * @param hash The hash of the method and the path
+ * @param method The request method
+ * @param path The path
+ * @param path_len The length of the path
+ * @param prefix Whether to look for a prefix or an exact route
+ * @return the route, NULL if there is none
+ */
+static const Route *find(const Router *self, uint64_t hash, const char *method,
+                         const char *path, size_t path_len, bool prefix)
+{
+    for (const Route *route = self->buckets[hash & (self->bucket_num - 1)];
+         route; route = route->next) {
+        if (route->hash == hash && route->prefix == prefix &&
+            route->path_len == path_len &&
+            memcmp(route->path, path, path_len) == 0 &&
+            strcmp(route->method, method) == 0)
+            return route;
     }
+    return NULL;
 }
 
 /**
- * search_route - Search for a route in the router
- * @param root Root node of the router
- * @param endpoint uri
- * @return Route object
+ * match - Find the route of a request. The path is hashed once, prefix
+ * routes are looked up at every segment boundary on the way.
+ * @param self The compiled router
+ * @param method The request method
+ * @param target The request target
+ * @return the route, NULL if there is none
  */
-static Route *search_route(Route *root, const char *key)
+static const Route *match(const Router *self, const char *method,
+                          const char *target)
 {
-    if (root == NULL) {
+    if (!self->buckets)
         return NULL;
+    size_t path_len = strcspn(target, "?#");
+    uint64_t hash = hash_method(method);
+    const Route *found = NULL;
+    for (size_t i = 0; i <= path_len; i++) {
+        // "/a/b" has the prefixes "/", "/a", "/a/" and "/a/b"
+        bool boundary = i == path_len || target[i] == '/' ||
+                        (i > 0 && target[i - 1] == '/');
+        if (boundary && i > 0) {
+            const Route *route = find(self, hash, method, target, i, true);
+            found = route ? route : found;
+        }
+        if (i < path_len)
+            hash = (hash ^ (uint8_t)target[i]) * FNV_PRIME;
     }
+    const Route *exact = find(self, hash, method, target, path_len, false);
+    return exact ? exact : found;
+}
 
-    if (strcmp(key, root->key) == 0) {
-        return root;
-    } else if (strcmp(key, root->key) > 0) {
-        return search_route(root->right, key);
-    } else if (strcmp(key, root->key) < 0) {
-        return search_route(root->left, key);
+/**
+ * list_routes - List all the routes in the router
+ * @param self The router
+ */
+static void list_routes(const Router *self)
+{
+    for (size_t i = 0; i < self->route_num; i++) {
+        const Route *route = &self->routes[i];
+        printf("%s %s%s -> %s \n", route->method, route->path,
+               route->prefix ? "*" : "", route->value ? route->value : "");
     }
-    return NULL;
 }
 
 /**
@@ -89,8 +167,13 @@ void init_router(Router **self)
         printf("Failed to allocate memory for router\n");
         exit(1);
     }
-    (*self)->root = NULL;
+    (*self)->routes = NULL;
+    (*self)->route_num = 0;
+    (*self)->route_cap = 0;
+    (*self)->buckets = NULL;
+    (*self)->bucket_num = 0;
     (*self)->add_route = &add_route;
-    (*self)->search_route = &search_route;
+    (*self)->compile = &compile;
+    (*self)->match = &match;
     (*self)->list_routes = &list_routes;
 }
@@ -1,132 +1,438 @@
+#define _POSIX_C_SOURCE 200809L
 #include "../include/server.h"
+#include "../include/response.h"
+#include "../include/utils.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
-#define TEMPLATE_SIZE 8192
 #define BUFFER_SIZE 8192
+#define MAX_HEADER_SIZE 65536
+#define MAX_EVENTS 256
+#define MAX_PENDING_REQUESTS 1024
+#define REQUEST_TIMEOUT 30
+#define KEEP_ALIVE_TIMEOUT 15
+#define SWEEP_INTERVAL 1000
+#define PATH_MAX_LEN 256
 
 /**
- * config_router - Configure all the endpoints for the server
+ * find_template - Look up a loaded template
  * @param self Server object
+ * @param name The file name under templates/
+ * @return the template, NULL if it is not loaded
  */
-static void config_router(Server *self)
+static const Template *find_template(Server *self, const char *name)
+{
+    for (size_t i = 0; i < self->template_num; i++) {
+        if (strcmp(self->templates[i].name, name) == 0)
+            return &self->templates[i];
+    }
+    return NULL;
+}
+
+/**
+ * load_template - Read a template and prepare the whole response for it, so
+ * a GET only has to send bytes that are already in memory
+ * @param self Server object
+ * @param name The file name under templates/
+ * @param status The status line sent with the page
+ */
+static void load_template(Server *self, const char *name, const char *status)
 {
-    self->router->add_route(&self->router->root, "/", "index.html");
+    if (find_template(self, name))
+        return;
+    char path[PATH_MAX_LEN];
+    snprintf(path, sizeof(path), "templates/%s", name);
+    const char *page = self->render_static_route(self, path);
+    if (!page)
+        exit(1);
+
+    size_t page_len = strlen(page);
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.1 %s\r\n"
+                              "Content-Type: text/html; charset=utf-8\r\n"
+                              "Content-Length: %zu\r\n\r\n",
+                              status, page_len);
+    Template *template = &self->templates[self->template_num++];
+    template->name = name;
+    template->status = status;
+    template->head_len = (size_t)header_len;
+    template->len = (size_t)header_len + page_len;
+    template->response = must_calloc(template->len, sizeof(char));
+    memcpy(template->response, header, (size_t)header_len);
+    memcpy(template->response + header_len, page, page_len);
+    free((void *)page);
 }
 
 /**
  * handle_get_request - Handle GET request
  * @param server Server object
- * @param route Route to handle
+ * @param route The page route, NULL if the request matched no route
+ * @return the page to send, the 404 page if there is no such route
  */
-static char *handle_get_requests(Server *self, const char *route)
+static const Template *handle_get_requests(Server *self, const Route *route)
 {
     self->logger->info_log("Handling GET request", __FILE__, __LINE__);
-    struct Route *destination =
-        self->router->search_route(self->router->root, route);
-    char template[100] = "templates/";
-    !destination ? strcat(template, "404.html")
-                 : strcat(template, destination->value);
-    return (char *)self->render_static_route(self, template);
+    const Template *page =
+        route && route->value ? find_template(self, route->value) : NULL;
+    return page ? page : find_template(self, "404.html");
+}
+
+/**
+ * serve_page - Send the page of a route
+ * @param self Server object
+ * @param req The request
+ * @param route The page route
+ */
+static void serve_page(Server *self, Request *req, const Route *route)
+{
+    self->send_template(req, self->handle_get_requests(self, route));
 }
 
 /**
- * get_file_content - Get file content from POST request
+ * config_router - Configure the pages of the server, compile the routes
+ * added so far and load the templates of the pages
  * @param self Server object
- * @param chunk http request to parse
- * @param content_len length of the returned content
- * @return File content
- */
-static const char *get_file_content(Server *self, const char *const chunk,
-                                    const size_t chunk_len, long *content_len)
-{
-    // get boundary
-    self->logger->info_log("Getting file content", __FILE__, __LINE__);
-    char boundary_header[] = "Content-Type: multipart/form-data; boundary=";
-    char *boundary = strstr(chunk, boundary_header) + strlen(boundary_header);
-    char *end_boundary = strstr(boundary, "\r\n");
-    size_t boundary_len = (size_t)(end_boundary - boundary);
-    char b[boundary_len];
-    strncpy(b, boundary, boundary_len);
-
-    // get file content
-    char *start = strstr(chunk, b) + boundary_len + 2;
-    start = strstr(start, b) + boundary_len + 2;
-    start = strstr(start, "\r\n\r\n") + 4;
-    char *end = strstr(start, b);
-
-    // if there is no end boundary calculate the length by subtracting start of
-    // form with the beginning of the chunk
-    *content_len = (end == NULL) ? (long)chunk_len - (start - chunk)
-                                 : end - start - 4; // 2 extra -- and  \r\n
-    return start;
-}
-
-/** get_content_length - Get http request content length
- * @param client_req Client request
- * @param total_size Total size of the request (where to store the result)
- */
-static void get_content_length(const char *client_req, ssize_t *total_size)
-{
-    int cur_line = 0;
-    char *content_len = malloc(1000);
-    for (int i = 0; i < 9; i++) {
-        sscanf(client_req + cur_line, "%s", content_len);
-        cur_line += strlen(content_len) + 2; // skip \n
-        if (strcmp(content_len, "Content-Length:") == 0) {
-            sscanf(client_req + cur_line - 2, "%s", content_len);
-            *total_size = atoi(content_len);
-            free(content_len);
+ */
+static void config_router(Server *self)
+{
+    Router *router = self->router;
+    router->add_route(router, "GET", "/", false, serve_page, "index.html");
+    router->compile(router);
+
+    // one page per route and the 404 page at most
+    self->templates = must_calloc(router->route_num + 1, sizeof(Template));
+    self->template_num = 0;
+    load_template(self, "404.html", "404 Not Found");
+    for (size_t i = 0; i < router->route_num; i++) {
+        if (router->routes[i].handler == serve_page)
+            load_template(self, router->routes[i].value, "200 OK");
+    }
+}
+
+typedef struct Connection Connection;
+struct Connection {
+    Server *server;
+    Request req;       // the request being read, owns the receive buffer
+    time_t idle_since; // when the connection started waiting for a request
+    Connection *prev;  // the neighbours in the server's idle list
+    Connection *next;
+};
+
+/**
+ * monotonic_now - Read a clock that does not jump with the wall clock
+ * @return the current time in seconds
+ */
+static time_t monotonic_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+/**
+ * unlink_idle - Remove a connection from the idle list, the caller holds the
+ * idle lock
+ * @param conn The connection
+ */
+static void unlink_idle(Connection *conn)
+{
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else if (conn->server->idle == conn)
+        conn->server->idle = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+    conn->prev = conn->next = NULL;
+}
+
+/**
+ * claim_connection - Take a connection off the idle list before handling it
+ * @param conn The connection
+ */
+static void claim_connection(Connection *conn)
+{
+    pthread_mutex_lock(&conn->server->idle_lock);
+    unlink_idle(conn);
+    pthread_mutex_unlock(&conn->server->idle_lock);
+}
+
+/**
+ * set_blocking - Switch a socket between blocking and non-blocking mode
+ * @param fd The socket
+ * @param blocking Whether calls on the socket should block
+ */
+static void set_blocking(int fd, bool blocking)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
+}
+
+/**
+ * close_connection - Close a connection and free its buffer
+ * @param conn The connection
+ */
+static void close_connection(Connection *conn)
+{
+    close(conn->req.fd);
+    free(conn->req.buf);
+    free(conn);
+}
+
+/**
+ * watch_connection - Wait for the next readable event of a connection. The
+ * event fires once, so only one thread handles a connection at a time.
+ * @param conn The connection
+ * @param op EPOLL_CTL_ADD for a new connection, EPOLL_CTL_MOD to re-arm it
+ */
+static void watch_connection(Connection *conn, int op)
+{
+    // the connection is listed before it is armed, so the event loop cannot
+    // claim it first
+    Server *server = conn->server;
+    pthread_mutex_lock(&server->idle_lock);
+    conn->next = server->idle;
+    if (server->idle)
+        server->idle->prev = conn;
+    server->idle = conn;
+    pthread_mutex_unlock(&server->idle_lock);
+
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT,
+                             .data.ptr = conn};
+    if (epoll_ctl(server->epoll_fd, op, conn->req.fd, &ev) == -1) {
+        server->logger->error_log("Failed to watch connection", __FILE__,
+                                  __LINE__);
+        claim_connection(conn);
+        close_connection(conn);
+    }
+}
+
+/**
+ * close_idle_connections - Close the connections that have waited too long
+ * for a request. Connections being handled are never in the idle list.
+ * @param self Server object
+ */
+static void close_idle_connections(Server *self)
+{
+    time_t now = monotonic_now();
+    pthread_mutex_lock(&self->idle_lock);
+    Connection *conn = self->idle;
+    while (conn) {
+        Connection *next = conn->next;
+        if (now - conn->idle_since >= KEEP_ALIVE_TIMEOUT) {
+            unlink_idle(conn);
+            close_connection(conn);
+        }
+        conn = next;
+    }
+    pthread_mutex_unlock(&self->idle_lock);
+}
+
+/**
+ * serve_connection - Run the request handler on a worker thread. The body is
+ * read by the handler with blocking calls that give up after REQUEST_TIMEOUT.
+ * Requests the client pipelined behind it are handled on the same thread,
+ * then the connection goes back to the event loop to wait for the next one.
+ * @param arg The connection whose headers have been parsed
+ */
+static void serve_connection(void *arg)
+{
+    Connection *conn = arg;
+    Request *req = &conn->req;
+    struct timeval timeout = {.tv_sec = REQUEST_TIMEOUT, .tv_usec = 0};
+    set_blocking(req->fd, true);
+    setsockopt(req->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(req->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    while (true) {
+        conn->server->handler(conn->server, req);
+        if (!req->reusable(req) || req->skip_body(req) != 0) {
+            req->discard_body(req);
+            close_connection(conn);
+            return;
+        }
+
+        // the bytes after the body belong to the next request
+        memmove(req->buf, req->buf + req->pos, req->len - req->pos);
+        req->len -= req->pos;
+        req->pos = 0;
+        req->buf[req->len] = '\0';
+        size_t header_len = find_header_end(req->buf, 0, req->len);
+        if (!header_len)
             break;
+        if (init_request(req, header_len) != 0) {
+            conn->server->send_bad_request_response(req);
+            close_connection(conn);
+            return;
         }
     }
+
+    set_blocking(req->fd, false);
+    conn->idle_since = monotonic_now();
+    watch_connection(conn, EPOLL_CTL_MOD);
 }
 
 /**
- * get_client_request
- * @param client_socket Client socket
- * @return Client request
- */
-static void get_client_request(int client_socket, char **client_req,
-                               size_t *req_len)
-{
-    ssize_t total_size = BUFFER_SIZE;
-    ssize_t size_recv = 0;
-    size_t ext_len = 1;
-    while (1) {
-        size_recv = recv(client_socket, *client_req + *req_len, BUFFER_SIZE,
-                         MSG_DONTWAIT);
-
-        // go ahead and respond to client if it is a GET request
-        if (*req_len == 0) {
-            char method[100];
-            sscanf(*client_req, "%s", method);
-            if (strcmp(method, "GET") == 0) {
-                break;
+ * read_connection - Read the request headers without blocking and hand the
+ * request to the worker pool once they are complete, or answer 503 when the
+ * pool has no room for it
+ * @param self Server object
+ * @param conn The readable connection
+ */
+static void read_connection(Server *self, Connection *conn)
+{
+    Request *req = &conn->req;
+    claim_connection(conn);
+    while (true) {
+        if (req->cap - req->len <= BUFFER_SIZE) {
+            size_t cap = req->cap * 2 + BUFFER_SIZE;
+            char *buf = realloc(req->buf, cap);
+            if (!buf) {
+                close_connection(conn);
+                return;
             }
+            req->buf = buf;
+            req->cap = cap;
         }
 
-        if (size_recv < 0) {
+        ssize_t size_recv =
+            recv(req->fd, req->buf + req->len, req->cap - req->len - 1, 0);
+        if (size_recv == -1 && errno == EINTR)
             continue;
+        if (size_recv == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (size_recv <= 0) {
+            close_connection(conn);
+            return;
         }
 
-        *req_len += (size_t)size_recv;
-        if (*req_len >= (BUFFER_SIZE * ext_len - 1)) {
-            ext_len += 2;
-            char *new_buffer = realloc(*client_req, BUFFER_SIZE * ext_len);
-            *client_req = new_buffer;
+        // only the bytes that just arrived can complete the blank line
+        size_t from = req->len > 3 ? req->len - 3 : 0;
+        req->len += (size_t)size_recv;
+        req->buf[req->len] = '\0';
+        size_t header_len = find_header_end(req->buf, from, req->len);
+        if (header_len) {
+            // the body is left for the handler to stream
+            if (init_request(req, header_len) != 0) {
+                self->logger->warn_log("Malformed request", __FILE__,
+                                       __LINE__);
+                self->send_bad_request_response(req);
+                close_connection(conn);
+                return;
+            }
+            // the event loop must never wait for a worker, turn the
+            // request away when every one of them is backed up
+            if (!self->pool->try_submit(self->pool, serve_connection, conn)) {
+                self->logger->warn_log("Server busy", __FILE__, __LINE__);
+                req->keep_alive = false;
+                Response resp;
+                init_response(&resp, req, "503 Service Unavailable");
+                resp.add_header(&resp, "Retry-After", "1");
+                resp.send(&resp, req->fd);
+                close_connection(conn);
+            }
+            return;
+        }
+        if (req->len > MAX_HEADER_SIZE) {
+            self->logger->warn_log("Request headers too large", __FILE__,
+                                   __LINE__);
+            close_connection(conn);
+            return;
         }
+    }
+    watch_connection(conn, EPOLL_CTL_MOD);
+}
 
-        get_content_length(*client_req, &total_size);
-        if (*req_len >= (size_t)total_size) {
+/**
+ * accept_connections - Accept every pending connection and start watching
+ * them
+ * @param self Server object
+ */
+static void accept_connections(Server *self)
+{
+    while (true) {
+        int client_socket = accept(self->socket, NULL, NULL);
+        if (client_socket == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                self->logger->error_log("Failed to accept connection",
+                                        __FILE__, __LINE__);
+            return;
+        }
+
+        set_blocking(client_socket, false);
+        Connection *conn = must_calloc(1, sizeof(Connection));
+        conn->server = self;
+        conn->req.fd = client_socket;
+        conn->idle_since = monotonic_now();
+        watch_connection(conn, EPOLL_CTL_ADD);
+    }
+}
+
+/**
+ * run - Serve clients from an epoll event loop. The loop only reads requests,
+ * complete requests are handled by a pool of worker threads.
+ * @param self Server object
+ * @param handler The request handler run on the workers
+ * @param worker_num The number of worker threads
+ */
+static void run(Server *self, RequestHandler handler, size_t worker_num)
+{
+    // a client hanging up mid-response must not kill the whole server
+    signal(SIGPIPE, SIG_IGN);
+    self->handler = handler;
+    self->idle = NULL;
+    pthread_mutex_init(&self->idle_lock, NULL);
+    self->pool = new_thread_pool(worker_num, MAX_PENDING_REQUESTS);
+    self->epoll_fd = epoll_create1(0);
+    if (self->epoll_fd == -1) {
+        self->logger->error_log("Failed to create epoll", __FILE__, __LINE__);
+        exit(1);
+    }
+
+    // the listening socket is the only event without a connection
+    set_blocking(self->socket, false);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, self->socket, &ev);
+
+    struct epoll_event events[MAX_EVENTS];
+    time_t last_sweep = monotonic_now();
+    while (true) {
+        int event_num =
+            epoll_wait(self->epoll_fd, events, MAX_EVENTS, SWEEP_INTERVAL);
+        if (event_num == -1) {
+            if (errno == EINTR)
+                continue;
+            self->logger->error_log("epoll_wait failed", __FILE__, __LINE__);
             break;
         }
+        for (int i = 0; i < event_num; i++) {
+            if (events[i].data.ptr == NULL)
+                accept_connections(self);
+            else
+                read_connection(self, events[i].data.ptr);
+        }
+        if (monotonic_now() != last_sweep) {
+            close_idle_connections(self);
+            last_sweep = monotonic_now();
+        }
     }
+    self->pool->destroy(&self->pool);
+    pthread_mutex_destroy(&self->idle_lock);
 }
 
 /**
@@ -142,7 +448,9 @@ static void parse_url_params(Server *self __attribute__((unused)),
 {
     /*self->logger->info_log("Parsing URL parameters", __FILE__, __LINE__);*/
     char *start = strchr(url, '?');
-    sscanf(start + 1, "out_file=%[^&]&service_type=%s", out_file, service_type);
+    if (start)
+        sscanf(start + 1, "out_file=%99[^&]&service_type=%99s", out_file,
+               service_type);
 }
 
 /**
@@ -161,6 +469,7 @@ static const char *render_static_route(Server *self, const char *endpoint)
     if (file == NULL) {
         perror("Error opening file");
         self->logger->error_log("Error opening file", __FILE__, __LINE__);
+        return NULL;
     }
 
     // get filename
@@ -169,36 +478,100 @@ static const char *render_static_route(Server *self, const char *endpoint)
     rewind(file);
 
     // store data
-    buffer = (char *)malloc((filelen + 1) * sizeof(char));
-    fread(buffer, filelen, 1, file);
+    buffer = (char *)must_calloc(filelen + 1, sizeof(char));
+    filelen = fread(buffer, 1, filelen, file);
+    buffer[filelen] = '\0';
     fclose(file);
     return buffer;
 }
 
 /**
  * send_not_found_response - Send a 404 Not Found response
- * @param client_socket Client socket
+ * @param req The request
  */
-static void send_not_found_response(int client_socket)
+static void send_not_found_response(Request *req)
 {
-    char http_header[TEMPLATE_SIZE] = "HTTP/1.1 404 Not Found\r\n\r\n";
-    send(client_socket, http_header, sizeof(http_header), 0);
-    close(client_socket);
+    Response resp;
+    init_response(&resp, req, "404 Not Found");
+    resp.send(&resp, req->fd);
+}
+
+/**
+ * send_bad_request_response - Send a 400 Bad Request response
+ * @param req The request
+ */
+static void send_bad_request_response(Request *req)
+{
+    Response resp;
+    init_response(&resp, req, "400 Bad Request");
+    resp.send(&resp, req->fd);
 }
 
 /**
  * send_ok_response - Send a 200 OK response
+ * @param req The request
+ * @param response_data The body of the response
+ */
+static void send_ok_response(Request *req, const char *response_data)
+{
+    Response resp;
+    init_response(&resp, req, "200 OK");
+    resp.add_body(&resp, response_data, strlen(response_data));
+    resp.send(&resp, req->fd);
+}
+
+/**
+ * send_template - Send a page prepared by config_router. The prepared
+ * headers keep the connection open, a connection about to close gets them
+ * built again with Connection: close.
+ * @param req The request
+ * @param page The page with its headers
+ * @return 0 on success, -1 if the client stopped receiving
+ */
+static int send_template(Request *req, const Template *page)
+{
+    if (!req->reusable(req)) {
+        Response resp;
+        init_response(&resp, req, page->status);
+        resp.add_header(&resp, "Content-Type", "text/html; charset=utf-8");
+        resp.add_body(&resp, page->response + page->head_len,
+                      page->len - page->head_len);
+        return resp.send(&resp, req->fd);
+    }
+
+    for (size_t sent = 0; sent < page->len;) {
+        ssize_t size_sent =
+            send(req->fd, page->response + sent, page->len - sent, 0);
+        if (size_sent == -1 && errno == EINTR)
+            continue;
+        if (size_sent <= 0)
+            return -1;
+        sent += (size_t)size_sent;
+    }
+    return 0;
+}
+
+/**
+ * send_file - Send part of a file straight from the page cache, without
+ * copying it through user space
  * @param client_socket Client socket
- * @param content_type Content type of the response
- * @param content_length Content length of the response
+ * @param fd The file
+ * @param offset Where the part starts
+ * @param len The length of the part
+ * @return 0 on success, -1 if the file or the client failed
  */
-static void send_ok_response(int client_socket, const char *response_data)
+static int send_file(int client_socket, int fd, off_t offset, size_t len)
 {
-    char http_header[TEMPLATE_SIZE] = "HTTP/1.1 200 OK\r\n\r\n";
-    strcat(http_header, response_data);
-    strcat(http_header, "\r\n\r\n");
-    send(client_socket, http_header, sizeof(http_header), 0);
-    close(client_socket);
+    while (len > 0) {
+        ssize_t size_sent = sendfile(client_socket, fd, &offset, len);
+        if (size_sent == -1 && errno == EINTR)
+            continue;
+        // the file shrinking under us ends the transfer early
+        if (size_sent <= 0)
+            return -1;
+        len -= (size_t)size_sent;
+    }
+    return 0;
 }
 
 /**
@@ -214,21 +587,29 @@ void init_server(Server **self, int port)
     }
 
     (*self)->port = port;
+    (*self)->templates = NULL;
+    (*self)->template_num = 0;
+    (*self)->cache = NULL;
+    (*self)->jobs = NULL;
     init_logger(&(*self)->logger);
     init_router(&(*self)->router);
     (*self)->config_router = &config_router;
     (*self)->render_static_route = &render_static_route;
     (*self)->send_ok_response = &send_ok_response;
+    (*self)->send_template = &send_template;
+    (*self)->send_file = &send_file;
     (*self)->send_not_found_response = &send_not_found_response;
+    (*self)->send_bad_request_response = &send_bad_request_response;
     (*self)->handle_get_requests = &handle_get_requests;
-    (*self)->get_file_content = &get_file_content;
     (*self)->parse_url_params = &parse_url_params;
-    (*self)->get_client_request = &get_client_request;
+    (*self)->run = &run;
 
     int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
     struct sockaddr_in server_address;
     server_address.sin_family = AF_INET;
-    server_address.sin_port = htons(port);
+    server_address.sin_port = htons((uint16_t)port);
     server_address.sin_addr.s_addr = INADDR_ANY;
 
     // bind port
@@ -242,7 +623,7 @@ void init_server(Server **self, int port)
 
     char msg[100];
     snprintf(msg, 100, "Server listening on port %d", port);
-    listen(server_socket, 5);
+    listen(server_socket, SOMAXCONN);
     (*self)->socket = server_socket;
     (*self)->logger->info_log(msg, __FILE__, __LINE__);
 }
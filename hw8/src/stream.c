@@ -0,0 +1,634 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../include/stream.h"
+#include "../include/pool.h"
+#include "../include/utils.h"
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct BlockIndex {
+    uint64_t *offsets;     // where every block starts in the container
+    uint64_t *raw_offsets; // where every block starts in the raw data
+    size_t len;
+    size_t cap;
+    uint64_t pos;     // the length of the container so far
+    uint64_t raw_pos; // the length of the raw data so far
+};
+
+typedef struct BlockJob BlockJob;
+struct BlockJob {
+    HuffmanTree *tree; // every job owns a tree, they are not thread-safe
+    char *raw;         // the raw data of the block
+    size_t raw_len;
+    size_t raw_cap;
+    char *block; // the encoded block
+    size_t block_cap;
+    uint64_t offset;     // where the block starts in the container
+    uint64_t raw_offset; // where the block starts in the raw data
+    uint64_t limit;      // where the blocks end in the container
+    int in_fd;
+    int out_fd;
+    int status;
+    bool done;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+bool is_packed(FILE *fd)
+{
+    char magic[PACKED_MAGIC_LEN];
+    bool packed = fread(magic, 1, PACKED_MAGIC_LEN, fd) == PACKED_MAGIC_LEN &&
+                  memcmp(magic, PACKED_MAGIC, PACKED_MAGIC_LEN) == 0;
+    rewind(fd);
+    return packed;
+}
+
+/**
+ * index_add - Record a block written to the container.
+ * @param index The block index.
+ * @param block_len The number of bytes the block takes in the container.
+ * @param raw_len The length of the raw data in the block.
+ */
+static void index_add(BlockIndex *index, size_t block_len, size_t raw_len)
+{
+    if (index->len == index->cap) {
+        index->cap = index->cap * 2 + 16;
+        index->offsets =
+            realloc(index->offsets, index->cap * sizeof(uint64_t));
+        index->raw_offsets =
+            realloc(index->raw_offsets, index->cap * sizeof(uint64_t));
+        if (!index->offsets || !index->raw_offsets) {
+            fprintf(stderr, "Error: realloc failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    index->offsets[index->len] = index->pos;
+    index->raw_offsets[index->len++] = index->raw_pos;
+    index->pos += block_len;
+    index->raw_pos += raw_len;
+}
+
+/**
+ * finish_index - Write the end block and the index, then free the index.
+ * @param index The block index.
+ * @param out The file to write to.
+ */
+static void finish_index(BlockIndex *index, FILE *out)
+{
+    write_packed_end(out, index->offsets, index->raw_offsets, index->len,
+                     (size_t)index->raw_pos);
+    free(index->offsets);
+    free(index->raw_offsets);
+}
+
+/**
+ * encode_block - Build the code table of a block and encode it.
+ * @param tree The Huffman tree, holding the code table afterwards.
+ * @param data The data of the block.
+ * @param len The length of the block.
+ * @return The packed bit stream.
+ */
+static char *encode_block(HuffmanTree *tree, const char *data,
+                          const size_t len)
+{
+    Node *leaves[SYMBOL_NUM];
+    tree->gen_freq_arr(tree, leaves, data, len);
+    tree->build_tree(tree, leaves, tree->size);
+    // packed blocks carry the code lengths, no text header is built
+    tree->cal_code_table(tree, leaves);
+
+    size_t encoded_len = 0;
+    char *encoded = tree->encode(tree, data, len, &encoded_len);
+    tree->destroy(&tree);
+    return encoded;
+}
+
+/**
+ * compress_block - Compress a block with its own code table and append it to
+ * a packed container.
+ * @param tree The Huffman tree.
+ * @param data The data of the block.
+ * @param len The length of the block.
+ * @param out The file to write to.
+ * @param index The block index.
+ */
+static void compress_block(HuffmanTree *tree, const char *data,
+                           const size_t len, FILE *out, BlockIndex *index)
+{
+    char *encoded = encode_block(tree, data, len);
+    index_add(index,
+              write_packed_block(out, tree->codes, len, encoded,
+                                 tree->encoded_bits),
+              len);
+    free(encoded);
+}
+
+/**
+ * encoder_write - Append data, compressing every block as soon as it is full
+ * @param self The encoder
+ * @param data The data to compress
+ * @param len The length of the data
+ */
+static void encoder_write(StreamEncoder *self, const char *data, size_t len)
+{
+    while (len > 0) {
+        // whole blocks are compressed in place without copying them
+        if (self->len == 0 && len >= BLOCK_SIZE) {
+            compress_block(self->tree, data, BLOCK_SIZE, self->out,
+                           self->index);
+            data += BLOCK_SIZE;
+            len -= BLOCK_SIZE;
+            continue;
+        }
+
+        size_t n = BLOCK_SIZE - self->len < len ? BLOCK_SIZE - self->len : len;
+        memcpy(self->block + self->len, data, n);
+        self->len += n;
+        data += n;
+        len -= n;
+        if (self->len == BLOCK_SIZE) {
+            compress_block(self->tree, self->block, BLOCK_SIZE, self->out,
+                           self->index);
+            self->len = 0;
+        }
+    }
+}
+
+/**
+ * encoder_finish - Compress the last block, terminate the container and free
+ * the encoder
+ * @param self The encoder
+ * @return 0 on success, -1 if writing the output failed
+ */
+static int encoder_finish(StreamEncoder **self)
+{
+    if (!self || !*self)
+        return -1;
+
+    StreamEncoder *encoder = *self;
+    if (encoder->len > 0)
+        compress_block(encoder->tree, encoder->block, encoder->len,
+                       encoder->out, encoder->index);
+    finish_index(encoder->index, encoder->out);
+    int status = fflush(encoder->out) == 0 && !ferror(encoder->out) ? 0 : -1;
+    free(encoder->index);
+    free(encoder->block);
+    free(encoder);
+    *self = NULL;
+    return status;
+}
+
+StreamEncoder *new_stream_encoder(HuffmanTree *tree, FILE *out)
+{
+    StreamEncoder *self = must_calloc(1, sizeof(StreamEncoder));
+    self->tree = tree;
+    self->out = out;
+    self->block = must_calloc(BLOCK_SIZE, sizeof(char));
+    self->len = 0;
+    self->index = must_calloc(1, sizeof(BlockIndex));
+    self->index->pos = PACKED_HEADER_LEN;
+    self->write = &encoder_write;
+    self->finish = &encoder_finish;
+    write_packed_magic(out);
+    return self;
+}
+
+/**
+ * new_block_jobs - Create the job slots shared by the workers.
+ * @param job_num The number of slots.
+ * @param raw_cap The size of the raw buffer of every slot.
+ * @return The job slots.
+ */
+static BlockJob *new_block_jobs(size_t job_num, size_t raw_cap)
+{
+    BlockJob *jobs = must_calloc(job_num, sizeof(BlockJob));
+    for (size_t i = 0; i < job_num; i++) {
+        jobs[i].tree = new_huffman_tree();
+        jobs[i].raw_cap = raw_cap;
+        jobs[i].raw = must_calloc(raw_cap + 1, sizeof(char));
+        jobs[i].done = true;
+        pthread_mutex_init(&jobs[i].lock, NULL);
+        pthread_cond_init(&jobs[i].cond, NULL);
+    }
+    return jobs;
+}
+
+/**
+ * free_block_jobs - Free the job slots once no worker uses them.
+ * @param jobs The job slots.
+ * @param job_num The number of slots.
+ */
+static void free_block_jobs(BlockJob *jobs, size_t job_num)
+{
+    for (size_t i = 0; i < job_num; i++) {
+        jobs[i].tree->destroy(&jobs[i].tree);
+        free(jobs[i].tree->logger);
+        free(jobs[i].tree);
+        free(jobs[i].raw);
+        free(jobs[i].block);
+        pthread_mutex_destroy(&jobs[i].lock);
+        pthread_cond_destroy(&jobs[i].cond);
+    }
+    free(jobs);
+}
+
+/**
+ * finish_job - Mark a job as done and wake up whoever waits for it.
+ * @param job The job.
+ */
+static void finish_job(BlockJob *job)
+{
+    pthread_mutex_lock(&job->lock);
+    job->done = true;
+    pthread_cond_signal(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+}
+
+/**
+ * wait_job - Wait until a job is done.
+ * @param job The job.
+ */
+static void wait_job(BlockJob *job)
+{
+    pthread_mutex_lock(&job->lock);
+    while (!job->done)
+        pthread_cond_wait(&job->cond, &job->lock);
+    pthread_mutex_unlock(&job->lock);
+}
+
+/**
+ * encode_job - Encode the block of a job on a worker.
+ * @param arg The job.
+ */
+static void encode_job(void *arg)
+{
+    BlockJob *job = arg;
+    job->block = encode_block(job->tree, job->raw, job->raw_len);
+    finish_job(job);
+}
+
+/**
+ * write_job - Wait for an encoded block and append it to the container.
+ * @param job The job.
+ * @param out The file to write to.
+ * @param index The block index.
+ */
+static void write_job(BlockJob *job, FILE *out, BlockIndex *index)
+{
+    wait_job(job);
+    index_add(index,
+              write_packed_block(out, job->tree->codes, job->raw_len,
+                                 job->block, job->tree->encoded_bits),
+              job->raw_len);
+    free(job->block);
+    job->block = NULL;
+}
+
+/**
+ * compress_parallel - Encode blocks on a thread pool while the next blocks
+ * are read, writing them back in order.
+ * @param tree The Huffman tree.
+ * @param in The file to compress.
+ * @param out The file to write to.
+ * @param jobs The number of worker threads.
+ * @return 0 on success, -1 if reading or writing failed.
+ */
+static int compress_parallel(HuffmanTree *tree, FILE *in, FILE *out,
+                              size_t jobs)
+{
+    tree->logger->info_log("Compressing blocks in parallel", __FILE__,
+                           __LINE__);
+    size_t slot_num = 2 * jobs;
+    BlockJob *slots = new_block_jobs(slot_num, BLOCK_SIZE);
+    ThreadPool *pool = new_thread_pool(jobs, slot_num);
+    BlockIndex index = {.len = 0, .cap = 0, .pos = PACKED_HEADER_LEN};
+
+    write_packed_magic(out);
+    size_t submitted = 0, written = 0;
+    while (true) {
+        // a slot is reused only after its block has been written
+        if (submitted - written == slot_num)
+            write_job(&slots[written++ % slot_num], out, &index);
+
+        BlockJob *job = &slots[submitted % slot_num];
+        if ((job->raw_len = fread(job->raw, 1, BLOCK_SIZE, in)) == 0)
+            break;
+        job->done = false;
+        pool->submit(pool, encode_job, job);
+        submitted++;
+    }
+    while (written < submitted)
+        write_job(&slots[written++ % slot_num], out, &index);
+    finish_index(&index, out);
+
+    pool->destroy(&pool);
+    free_block_jobs(slots, slot_num);
+    // a short read is only the end of the file if the stream has no error
+    return !ferror(in) && fflush(out) == 0 && !ferror(out) ? 0 : -1;
+}
+
+int compress_stream(HuffmanTree *tree, FILE *in, FILE *out, size_t jobs)
+{
+    tree->logger->info_log("Compressing stream", __FILE__, __LINE__);
+    int status;
+    if (jobs > 1) {
+        status = compress_parallel(tree, in, out, jobs);
+    } else {
+        char *block = must_calloc(BLOCK_SIZE, sizeof(char));
+        StreamEncoder *encoder = new_stream_encoder(tree, out);
+        size_t len;
+        while ((len = fread(block, 1, BLOCK_SIZE, in)) > 0)
+            encoder->write(encoder, block, len);
+        status = encoder->finish(&encoder);
+        if (ferror(in))
+            status = -1;
+        free(block);
+    }
+
+    if (status != 0) {
+        tree->logger->error_log("Error compressing stream", __FILE__,
+                                __LINE__);
+        return -1;
+    }
+    tree->logger->info_log("Stream compressed", __FILE__, __LINE__);
+    return 0;
+}
+
+/**
+ * read_le - Read a little-endian integer from a block header.
+ * @param data The start of the integer.
+ * @param width The number of bytes.
+ * @return The integer.
+ */
+static uint64_t read_le(const unsigned char *data, size_t width)
+{
+    uint64_t value = 0;
+    for (size_t i = width; i > 0; i--)
+        value = (value << 8) | data[i - 1];
+    return value;
+}
+
+/**
+ * read_at - Read exactly len bytes at an offset of a file.
+ * @return true if all the bytes were read.
+ */
+static bool read_at(int fd, void *buf, size_t len, uint64_t offset)
+{
+    for (size_t done = 0; done < len;) {
+        ssize_t n =
+            pread(fd, (char *)buf + done, len - done, (off_t)(offset + done));
+        if (n <= 0)
+            return false;
+        done += (size_t)n;
+    }
+    return true;
+}
+
+/**
+ * write_at - Write exactly len bytes at an offset of a file.
+ * @return true if all the bytes were written.
+ */
+static bool write_at(int fd, const void *buf, size_t len, uint64_t offset)
+{
+    for (size_t done = 0; done < len;) {
+        ssize_t n = pwrite(fd, (const char *)buf + done, len - done,
+                           (off_t)(offset + done));
+        if (n <= 0)
+            return false;
+        done += (size_t)n;
+    }
+    return true;
+}
+
+/**
+ * read_index - Load the block index from the end of a packed container.
+ * @param fd The packed container.
+ * @param index The block index, pos is set to where the blocks end.
+ * @return 0 on success, -1 if the container has no usable index.
+ */
+static int read_index(int fd, BlockIndex *index)
+{
+    struct stat st;
+    unsigned char trailer[INDEX_TRAILER_LEN];
+    uint64_t min_len = PACKED_HEADER_LEN + BLOCK_HEADER_LEN + INDEX_TRAILER_LEN;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        (uint64_t)st.st_size < min_len ||
+        !read_at(fd, trailer, INDEX_TRAILER_LEN,
+                 (uint64_t)st.st_size - INDEX_TRAILER_LEN))
+        return -1;
+
+    uint64_t raw_len = read_le(trailer, 8);
+    uint64_t block_num = read_le(trailer + 8, 8);
+    if (block_num > ((uint64_t)st.st_size - min_len) / INDEX_ENTRY_LEN)
+        return -1;
+
+    size_t entries_len = (size_t)block_num * INDEX_ENTRY_LEN;
+    uint64_t entries_start =
+        (uint64_t)st.st_size - INDEX_TRAILER_LEN - entries_len;
+    unsigned char *entries = must_calloc(entries_len + 1, sizeof(char));
+    index->len = index->cap = (size_t)block_num;
+    index->offsets = must_calloc(index->len + 1, sizeof(uint64_t));
+    index->raw_offsets = must_calloc(index->len + 1, sizeof(uint64_t));
+    index->pos = entries_start - BLOCK_HEADER_LEN;
+    index->raw_pos = raw_len;
+
+    // offsets must grow block by block and stay before the end block
+    int status = read_at(fd, entries, entries_len, entries_start) ? 0 : -1;
+    for (size_t i = 0; i < index->len && status == 0; i++) {
+        uint64_t *offset = &index->offsets[i];
+        uint64_t *raw_offset = &index->raw_offsets[i];
+        *offset = read_le(entries + i * INDEX_ENTRY_LEN, 8);
+        *raw_offset = read_le(entries + i * INDEX_ENTRY_LEN + 8, 8);
+        bool in_order =
+            i == 0 ? *offset == PACKED_HEADER_LEN && *raw_offset == 0
+                   : *offset > offset[-1] && *raw_offset > raw_offset[-1] &&
+                         *raw_offset - raw_offset[-1] <= MAX_BLOCK_SIZE;
+        if (!in_order || *offset >= index->pos || *raw_offset >= raw_len)
+            status = -1;
+    }
+    uint64_t last = index->len ? index->raw_offsets[index->len - 1] : 0;
+    if (raw_len - last > MAX_BLOCK_SIZE)
+        status = -1;
+
+    free(entries);
+    if (status != 0) {
+        free(index->offsets);
+        free(index->raw_offsets);
+    }
+    return status;
+}
+
+/**
+ * decode_job - Read, decode and write back the block of a job on a worker.
+ * @param arg The job.
+ */
+static void decode_job(void *arg)
+{
+    BlockJob *job = arg;
+    unsigned char header[BLOCK_HEADER_LEN];
+    job->status = -1;
+
+    if (!read_at(job->in_fd, header, BLOCK_HEADER_LEN, job->offset)) {
+        finish_job(job);
+        return;
+    }
+    size_t raw_len = (size_t)read_le(header, 4);
+    size_t block_len = (size_t)read_le(header + 4, 4);
+    uint64_t block_start = job->offset + BLOCK_HEADER_LEN;
+    if (raw_len != job->raw_len || raw_len > MAX_BLOCK_SIZE ||
+        block_len > MAX_BLOCK_LEN(raw_len) ||
+        block_len > job->limit - block_start) {
+        finish_job(job);
+        return;
+    }
+
+    if (block_len > job->block_cap) {
+        free(job->block);
+        job->block = must_calloc(job->block_cap = block_len, sizeof(char));
+    }
+    if (raw_len > job->raw_cap) {
+        free(job->raw);
+        job->raw = must_calloc(job->raw_cap = raw_len, sizeof(char));
+    }
+    if (read_at(job->in_fd, job->block, block_len, block_start) &&
+        job->tree->decode_block(job->tree, job->block, block_len, job->raw,
+                                raw_len) == 0 &&
+        write_at(job->out_fd, job->raw, raw_len, job->raw_offset))
+        job->status = 0;
+    finish_job(job);
+}
+
+/**
+ * decompress_parallel - Decode the blocks listed in the index on a thread
+ * pool, every block written straight to its place in the output.
+ * @param tree The Huffman tree.
+ * @param in The packed container.
+ * @param out The file to write to.
+ * @param jobs The number of worker threads.
+ * @return 0 on success, -1 if a block is malformed, 1 if the container has
+ * no usable index or either file is not a regular file.
+ */
+static int decompress_parallel(HuffmanTree *tree, FILE *in, FILE *out,
+                               size_t jobs)
+{
+    // blocks are written at their offsets, which needs a regular output;
+    // read_index checks the input
+    BlockIndex index;
+    int in_fd = fileno(in), out_fd = fileno(out);
+    struct stat st;
+    if (fstat(out_fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        read_index(in_fd, &index) != 0)
+        return 1;
+    tree->logger->info_log("Decompressing blocks in parallel", __FILE__,
+                           __LINE__);
+
+    fflush(out);
+    if (ftruncate(out_fd, (off_t)index.raw_pos) != 0) {
+        tree->logger->error_log("Failed to size the output", __FILE__,
+                                __LINE__);
+        free(index.offsets);
+        free(index.raw_offsets);
+        return -1;
+    }
+
+    size_t slot_num = 2 * jobs;
+    BlockJob *slots = new_block_jobs(slot_num, BLOCK_SIZE);
+    ThreadPool *pool = new_thread_pool(jobs, slot_num);
+    int status = 0;
+    for (size_t i = 0; i < index.len; i++) {
+        BlockJob *job = &slots[i % slot_num];
+        wait_job(job);
+        status |= job->status;
+
+        uint64_t raw_end =
+            i + 1 < index.len ? index.raw_offsets[i + 1] : index.raw_pos;
+        job->offset = index.offsets[i];
+        job->raw_offset = index.raw_offsets[i];
+        job->raw_len = (size_t)(raw_end - job->raw_offset);
+        job->limit = index.pos;
+        job->in_fd = in_fd;
+        job->out_fd = out_fd;
+        job->done = false;
+        pool->submit(pool, decode_job, job);
+    }
+    for (size_t i = 0; i < slot_num; i++) {
+        wait_job(&slots[i]);
+        status |= slots[i].status;
+    }
+
+    pool->destroy(&pool);
+    free_block_jobs(slots, slot_num);
+    free(index.offsets);
+    free(index.raw_offsets);
+    return status == 0 ? 0 : -1;
+}
+
+int decompress_stream(HuffmanTree *tree, FILE *in, FILE *out, size_t jobs)
+{
+    tree->logger->info_log("Decompressing stream", __FILE__, __LINE__);
+    unsigned char header[BLOCK_HEADER_LEN];
+    if (fread(header, 1, PACKED_HEADER_LEN, in) != PACKED_HEADER_LEN ||
+        memcmp(header, PACKED_MAGIC, PACKED_MAGIC_LEN) != 0 ||
+        header[PACKED_MAGIC_LEN] != PACKED_VERSION) {
+        tree->logger->error_log("Unsupported container", __FILE__, __LINE__);
+        return -1;
+    }
+
+    // without a usable index the blocks are decoded one after another
+    int status = jobs > 1 ? decompress_parallel(tree, in, out, jobs) : 1;
+    if (status <= 0) {
+        if (status != 0)
+            tree->logger->error_log("Corrupted container", __FILE__,
+                                    __LINE__);
+        tree->logger->info_log("Stream decompressed", __FILE__, __LINE__);
+        return status;
+    }
+
+    // the buffers only grow up to the largest block in the container
+    char *block = NULL, *raw = NULL;
+    size_t block_cap = 0, raw_cap = 0;
+    bool written = true;
+    status = -1;
+    while (fread(header, 1, BLOCK_HEADER_LEN, in) == BLOCK_HEADER_LEN) {
+        size_t raw_len = (size_t)read_le(header, 4);
+        size_t block_len = (size_t)read_le(header + 4, 4);
+        if (raw_len == 0) {
+            status = 0;
+            break;
+        }
+        if (raw_len > MAX_BLOCK_SIZE || block_len > MAX_BLOCK_LEN(raw_len)) {
+            tree->logger->error_log("Malformed block", __FILE__, __LINE__);
+            break;
+        }
+
+        if (block_len > block_cap) {
+            free(block);
+            block = must_calloc(block_cap = block_len, sizeof(char));
+        }
+        if (raw_len > raw_cap) {
+            free(raw);
+            raw = must_calloc(raw_cap = raw_len, sizeof(char));
+        }
+        if (fread(block, 1, block_len, in) != block_len ||
+            tree->decode_block(tree, block, block_len, raw, raw_len) != 0)
+            break;
+        if (fwrite(raw, 1, raw_len, out) != raw_len) {
+            written = false;
+            break;
+        }
+    }
+    if (fflush(out) != 0 || ferror(out))
+        written = false;
+
+    if (!written) {
+        tree->logger->error_log("Error writing file", __FILE__, __LINE__);
+        status = -1;
+    } else if (status != 0) {
+        tree->logger->error_log("Corrupted container", __FILE__, __LINE__);
+    }
+    free(block);
+    free(raw);
+    tree->logger->info_log("Stream decompressed", __FILE__, __LINE__);
+    return status;
+}
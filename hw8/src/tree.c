@@ -5,48 +5,136 @@
 #include <stdlib.h>
 #include <string.h>
 #define ALLOC_SIZE 256
+#define LOOKUP_BITS 11
+#define SUB_LOOKUP_BITS (MAX_CODE_LEN - LOOKUP_BITS)
+// a first-level table plus at most one second-level table per byte value
+#define DECODE_TABLE_SIZE                                                      \
+    ((1 << LOOKUP_BITS) + SYMBOL_NUM * (1 << SUB_LOOKUP_BITS))
+
+typedef struct BitReader BitReader;
+struct BitReader {
+    const unsigned char *data; // the packed bit stream
+    size_t len;                // the length of the stream in bytes
+    size_t pos;                // the next byte to be buffered
+    uint64_t acc;              // buffered bits, left-aligned
+    unsigned count;            // the number of buffered bits
+};
+
+typedef struct DecodeEntry DecodeEntry;
+struct DecodeEntry {
+    uint16_t next;  // offset of the second-level table, 0 for a leaf entry
+    uint8_t symbol; // the decoded byte
+    uint8_t len;    // the full code length, 0 if no code has this prefix
+};
+
+typedef struct BitWriter BitWriter;
+struct BitWriter {
+    uint64_t acc; // pending bits, right-aligned
+    unsigned len; // the number of pending bits
+    char *out;    // the output buffer
+    size_t pos;   // the write position in the output buffer
+    bool text;    // write '0'/'1' characters instead of packed bytes
+};
 
 /**
- * Swap two nodes
- * @param a The first node
- * @param b The second node
- * @param width The size of the node
+ * Write the highest bits of a byte to the output
+ * @param writer The bit writer
+ * @param byte The byte to be written
+ * @param width The number of bits to be written, the rest is zero padding
+ */
+static inline void emit_byte(BitWriter *writer, unsigned byte, unsigned width)
+{
+    if (!writer->text) {
+        writer->out[writer->pos++] = (char)byte;
+        return;
+    }
+    for (unsigned i = 8; i > 8 - width; i--)
+        writer->out[writer->pos++] = (char)('0' + ((byte >> (i - 1)) & 1));
+}
+
+/**
+ * Read a bit from the encoded data
+ * @param data The encoded data
+ * @param i The index of the bit
+ * @param text Whether the data is '0'/'1' characters or packed bytes
+ * @return the bit
+ */
+static inline unsigned get_bit(const char *data, size_t i, bool text)
+{
+    if (text)
+        return data[i] == '1';
+    return ((unsigned char)data[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+/**
+ * Append at most 32 bits to the accumulator and flush every complete byte
+ * @param writer The bit writer
+ * @param bits The bits to be appended, right-aligned
+ * @param len The number of bits
+ */
+static inline void put_bits(BitWriter *writer, uint64_t bits, unsigned len)
+{
+    writer->acc = (writer->acc << len) | bits;
+    writer->len += len;
+    while (writer->len >= 8) {
+        writer->len -= 8;
+        emit_byte(writer, (unsigned)(writer->acc >> writer->len) & 0xff, 8);
+    }
+}
+
+/**
+ * Append a code of any length to the accumulator
+ * @param writer The bit writer
+ * @param code The code to be appended
  */
-static void swap(void *a, void *b, size_t width)
+static inline void put_code(BitWriter *writer, HuffmanCode code)
 {
-    void *tmp = must_calloc(1, width);
-    memcpy(tmp, a, width);
-    memcpy(a, b, width);
-    memcpy(b, tmp, width);
-    free(tmp);
+    if (code.len > 32) {
+        put_bits(writer, code.bits >> 32, code.len - 32u);
+        put_bits(writer, code.bits & 0xffffffff, 32);
+    } else {
+        put_bits(writer, code.bits, code.len);
+    }
 }
 
 /**
- * Create an array of nodes from the given data
- * @param data The data to be stored in the node
- * @return The len of the array
+ * Count every byte value in one pass and create a leaf for each of them
+ * @param freq_node_arr The leaves, at least SYMBOL_NUM long
+ * @param data The data to be counted
+ * @param data_len The length of the data
  */
 static void gen_freq_arr(HuffmanTree *self, Node *freq_node_arr[],
                          const char data[], const size_t data_len)
 {
     self->logger->info_log("Reading file and generating frequency table",
                            __FILE__, __LINE__);
-    char cur_datum = data[0];
-    init_node_arr(freq_node_arr, data_len);
+    const unsigned char *bytes = (const unsigned char *)data;
+
+    // spread consecutive bytes over four histograms so that runs of the same
+    // byte do not wait on the previous increment of the same counter
+    uint64_t freq[4][SYMBOL_NUM] = {{0}};
+    size_t i = 0;
+    for (; i + 4 <= data_len; i += 4) {
+        freq[0][bytes[i]]++;
+        freq[1][bytes[i + 1]]++;
+        freq[2][bytes[i + 2]]++;
+        freq[3][bytes[i + 3]]++;
+    }
+    for (; i < data_len; i++)
+        freq[0][bytes[i]]++;
 
+    // every block starts a new tree in the same arena
+    reset_arena(&self->arena);
+    self->root = NULL;
+    init_node_arr(freq_node_arr, SYMBOL_NUM);
     size_t freq_arr_len = 0;
-    for (size_t i = 0; i < data_len; cur_datum = data[++i]) {
-        bool is_datum_in_arr = false;
-        for (size_t j = 0; j < freq_arr_len; j++) {
-            if (freq_node_arr[j]->data == cur_datum) {
-                freq_node_arr[j]->freq++;
-                is_datum_in_arr = true;
-                break;
-            }
-        }
-        if (!is_datum_in_arr) {
-            freq_node_arr[freq_arr_len++] = create_node(cur_datum);
-        }
+    for (size_t byte = 0; byte < SYMBOL_NUM; byte++) {
+        uint64_t total =
+            freq[0][byte] + freq[1][byte] + freq[2][byte] + freq[3][byte];
+        if (total == 0)
+            continue;
+        freq_node_arr[freq_arr_len] = create_node(&self->arena, (char)byte);
+        freq_node_arr[freq_arr_len++]->freq = total;
     }
     self->size = freq_arr_len;
 }
@@ -62,9 +150,9 @@ int compare_node(const void *a, const void *b)
 {
     Node *node_a = *(Node **)a;
     Node *node_b = *(Node **)b;
-    int freq_cmp = node_a->freq - node_b->freq;
-    int data_cmp = node_a->data - node_b->data;
-    return freq_cmp != 0 ? freq_cmp : data_cmp;
+    if (node_a->freq != node_b->freq)
+        return node_a->freq < node_b->freq ? -1 : 1;
+    return node_a->data - node_b->data;
 }
 
 int compare_char(const void *a, const void *b)
@@ -76,265 +164,405 @@ int compare_char(const void *a, const void *b)
 
 /**
  * Merge two nodes
+ * @param arena The arena holding the nodes
  * @param a The first node
  * @param b The second node
  * @return The parent of the two nodes
  */
-Node *merge_node(Node *a, Node *b)
+Node *merge_node(NodeArena *arena, Node *a, Node *b)
 {
-    Node *newnode = create_node('\0');
+    Node *newnode = create_node(arena, '\0');
+    int16_t a_idx = (int16_t)(a - arena->nodes);
+    int16_t b_idx = (int16_t)(b - arena->nodes);
+    int16_t new_idx = (int16_t)(newnode - arena->nodes);
     bool a_smaller = a->data < b->data;
-    newnode->left = a_smaller ? a : b;
-    newnode->right = a_smaller ? b : a;
+    newnode->left = a_smaller ? a_idx : b_idx;
+    newnode->right = a_smaller ? b_idx : a_idx;
     newnode->freq = a->freq + b->freq;
-    newnode->data = newnode->left->data;
-    a->p = newnode;
-    b->p = newnode;
+    newnode->data = a_smaller ? a->data : b->data;
+    a->p = new_idx;
+    b->p = new_idx;
     return newnode;
 }
 
 /**
- * Create a Huffman tree from the given data
+ * Take the lighter front node of the two queues
+ * @param queue The leaves followed by the merged nodes
+ * @param leaf The front of the leaf queue
+ * @param leaf_end The end of the leaf queue
+ * @param merged The front of the merged queue
+ * @param merged_end The end of the merged queue
+ * @return The node taken
+ */
+static Node *pop_lightest(Node **queue, size_t *leaf, size_t leaf_end,
+                          size_t *merged, size_t merged_end)
+{
+    if (*leaf < leaf_end &&
+        (*merged == merged_end ||
+         compare_node(&queue[*leaf], &queue[*merged]) <= 0))
+        return queue[(*leaf)++];
+    return queue[(*merged)++];
+}
+
+/**
+ * Create a Huffman tree from the given leaves. The leaves are sorted once and
+ * merged nodes are created in order of weight, so the two lightest nodes are
+ * always at the front of either queue.
  * @param self The Huffman tree
- * @param data The data to be stored in the tree
- * @param len The length of the data
+ * @param arr The leaves
+ * @param len The number of leaves
  */
 static void build_tree(HuffmanTree *self, Node *arr[], const size_t len)
 {
     self->logger->info_log("Building tree", __FILE__, __LINE__);
-    if (self->size <= 0)
+    if (len == 0)
         return;
 
-    Node **tmp = must_calloc(len, sizeof(Node *));
-    memcpy(tmp, arr, sizeof(Node *) * len);
+    Node **queue = must_calloc(2 * len, sizeof(Node *));
+    memcpy(queue, arr, sizeof(Node *) * len);
+    qsort(queue, len, sizeof(Node *), compare_node);
 
-    size_t end = self->size;
-    for (size_t i = 0; tmp[i] != NULL; i += 2) {
-        qsort(tmp + i, end - i, sizeof(Node *), compare_node);
-        if (tmp[i + 1] == NULL) {
-            self->root = tmp[i];
-            break;
-        }
-        tmp[end++] = merge_node(tmp[i], tmp[i + 1]);
+    size_t leaf = 0, merged = len, end = len;
+    for (size_t i = 1; i < len; i++) {
+        Node *a = pop_lightest(queue, &leaf, len, &merged, end);
+        Node *b = pop_lightest(queue, &leaf, len, &merged, end);
+        queue[end++] = merge_node(&self->arena, a, b);
     }
+    self->root = queue[end - 1];
     self->logger->info_log("Tree built", __FILE__, __LINE__);
-    free(tmp);
+    free(queue);
 }
 
 /**
- * Get the Huffman code
+ * Get the depth of a leaf, i.e. the length of its Huffman code
  * @param self the Huffman tree
- * @param node to be encoded
+ * @param cur_node the leaf to be encoded
+ * @return the depth of the leaf
  */
-static char *get_code(const HuffmanTree *self, Node *cur_node)
+static size_t get_depth(const HuffmanTree *self, const Node *cur_node)
 {
-    if (!cur_node)
-        return NULL;
+    // a tree of a single symbol still needs one bit per byte
+    if (cur_node == self->root)
+        return 1;
+
+    size_t depth = 0;
+    const Node *nodes = self->arena.nodes;
+    for (; cur_node != self->root; cur_node = &nodes[cur_node->p])
+        depth++;
+    return depth;
+}
 
-    size_t i = 0, j = 1;
-    char *code = must_calloc(ALLOC_SIZE, sizeof(char));
-    while (cur_node != self->root) {
-        if (i >= ALLOC_SIZE * j) {
-            code = realloc(code, sizeof(char) * ALLOC_SIZE * ++j);
-        }
-        code[i++] = cur_node->p->left == cur_node ? '0' : '1';
-        cur_node = cur_node->p;
+/**
+ * Limit the code lengths to MAX_CODE_LEN while keeping a valid prefix code.
+ * The lengths are redistributed so that more frequent leaves never get longer
+ * codes than less frequent ones.
+ * @param self The Huffman tree
+ * @param data The leaves of the tree
+ * @param depths The depth of every leaf in the tree
+ */
+static void limit_code_lens(HuffmanTree *self, Node *data[],
+                            const size_t depths[])
+{
+    size_t len_count[MAX_CODE_LEN + 1] = {0};
+    for (size_t i = 0; i < self->size; i++)
+        len_count[depths[i] > MAX_CODE_LEN ? MAX_CODE_LEN : depths[i]]++;
+
+    // lengthen the longest codes below the limit until the Kraft sum fits
+    size_t kraft = 0;
+    for (size_t len = 1; len <= MAX_CODE_LEN; len++)
+        kraft += len_count[len] << (MAX_CODE_LEN - len);
+    while (kraft > (size_t)1 << MAX_CODE_LEN) {
+        size_t len = MAX_CODE_LEN - 1;
+        while (len_count[len] == 0)
+            len--;
+        len_count[len]--;
+        len_count[len + 1]++;
+        kraft -= (size_t)1 << (MAX_CODE_LEN - len - 1);
     }
-    code[i] = '\0';
 
-    // reverse the code
-    for (size_t i = 0, j = strlen(code) - 1; i < j; i++, j--)
-        swap(&code[i], &code[j], sizeof(char));
+    // hand out the lengths from the most frequent leaf to the least
+    Node **sorted = must_calloc(self->size, sizeof(Node *));
+    memcpy(sorted, data, self->size * sizeof(Node *));
+    qsort(sorted, self->size, sizeof(Node *), compare_node);
+    size_t i = self->size;
+    for (uint8_t len = 1; len <= MAX_CODE_LEN; len++)
+        for (size_t j = 0; j < len_count[len]; j++)
+            self->codes[(unsigned char)sorted[--i]->data].len = len;
+    free(sorted);
+}
 
-    return code;
+/**
+ * Assign canonical codes to a code table whose lengths are already set.
+ * Shorter codes come first and codes of the same length are ordered by byte,
+ * so the lengths alone are enough to regenerate the codes.
+ * @param codes The code table
+ */
+static void assign_canonical_codes(HuffmanCode codes[])
+{
+    uint64_t len_count[MAX_CODE_LEN + 1] = {0};
+    for (size_t i = 0; i < SYMBOL_NUM; i++)
+        len_count[codes[i].len]++;
+    len_count[0] = 0;
+
+    uint64_t next_code[MAX_CODE_LEN + 1] = {0};
+    for (size_t len = 1; len <= MAX_CODE_LEN; len++)
+        next_code[len] = (next_code[len - 1] + len_count[len - 1]) << 1;
+
+    for (size_t i = 0; i < SYMBOL_NUM; i++)
+        if (codes[i].len > 0)
+            codes[i].bits = next_code[codes[i].len]++;
 }
 
 /**
- * Create a Huffman tree from the given data
+ * Calculate the canonical code of every leaf and compile them into
+ * self->codes
  * @param self The Huffman tree
- * @param data The data to be stored in the tree
- * @param len The length of the data
- * @return the header of the encoded file
+ * @param data The leaves of the tree
+ * @return the header of the encoded file in the legacy text format, NULL
+ * unless text_format is set since packed blocks only need self->codes
  */
 static const char **cal_code_table(HuffmanTree *self, Node *data[])
 {
 
     self->logger->info_log("Calculating code", __FILE__, __LINE__);
-    char **header = must_calloc(sizeof(char *), self->size);
     qsort(data, self->size, sizeof(Node *), compare_char);
+    memset(self->codes, 0, sizeof(self->codes));
+    self->encoded_bits = 0;
 
+    bool too_long = false;
+    size_t *depths = must_calloc(self->size + 1, sizeof(size_t));
     for (size_t i = 0; i < self->size; i++) {
-        char *code = get_code(self, data[i]);
-        header[i] = must_calloc(ALLOC_SIZE, sizeof(char));
-        snprintf(header[i], ALLOC_SIZE, "%x=%s", data[i]->data, code);
-        free(code);
+        depths[i] = get_depth(self, data[i]);
+        too_long |= depths[i] > MAX_CODE_LEN;
+        self->codes[(unsigned char)data[i]->data].len = (uint8_t)depths[i];
+    }
+    if (too_long)
+        limit_code_lens(self, data, depths);
+    free(depths);
+    assign_canonical_codes(self->codes);
+
+    for (size_t i = 0; i < self->size; i++)
+        self->encoded_bits += (size_t)data[i]->freq *
+                              self->codes[(unsigned char)data[i]->data].len;
+    if (!self->text_format)
+        return NULL;
+
+    char **header = must_calloc(sizeof(char *), self->size);
+    for (size_t i = 0; i < self->size; i++) {
+        HuffmanCode code = self->codes[(unsigned char)data[i]->data];
+
+        // serialize the code as "<byte in hex>=<code in 0/1>"
+        header[i] = must_calloc(code.len + 4u, sizeof(char));
+        int offset =
+            snprintf(header[i], 4, "%x=", (unsigned char)data[i]->data);
+        for (unsigned j = code.len; j > 0; j--)
+            header[i][offset++] = (char)('0' + ((code.bits >> (j - 1)) & 1));
     }
     return (const char **)header;
 }
 
 /**
- * Get the Huffman code from raw data string
+ * Encode the given data with the compiled code table
  * @param self The Huffman tree
- * @param header_str the raw data string
- * @return the header of the encoded file
+ * @param data The data to be encoded
+ * @param raw_len The length of the data
+ * @param encoded_len The length of the encoded data
+ * @return the encoded data
  */
-static const char **get_header(HuffmanTree *self, const char *encoded_str)
+static char *encode(HuffmanTree *self, const char *data, const size_t raw_len,
+                    size_t *encoded_len)
 {
-    self->logger->info_log("Extracting header", __FILE__, __LINE__);
-    char **header = must_calloc(ALLOC_SIZE, sizeof(char *));
-    int cur_idx = 0;
-
-    char line[ALLOC_SIZE];
-    while (sscanf(encoded_str + cur_idx, "%s", line)) {
-        if (strncmp(line, "Uncompressed", 12) == 0) {
-            self->size--;
-            break;
-        }
-
-        size_t len = strlen(line);
-        header[self->size] = must_calloc(len + 1, sizeof(char));
-        strcpy(header[self->size++], line);
-        cur_idx += len + 1;
-    }
-    self->size += 1;
-    self->logger->info_log("Header extracted", __FILE__, __LINE__);
-    return (const char **)header;
+    self->logger->info_log("Encoding", __FILE__, __LINE__);
+    const unsigned char *bytes = (const unsigned char *)data;
+
+    // the output size is known from the frequencies, so allocate it once
+    BitWriter writer = {.acc = 0, .len = 0, .pos = 0};
+    writer.text = self->text_format;
+    writer.out = must_calloc(writer.text ? self->encoded_bits + 1
+                                         : (self->encoded_bits + 7) / 8 + 1,
+                             sizeof(char));
+
+    for (size_t i = 0; i < raw_len; i++)
+        put_code(&writer, self->codes[bytes[i]]);
+    if (writer.len > 0)
+        emit_byte(&writer, (unsigned)(writer.acc << (8 - writer.len)) & 0xff,
+                  writer.len);
+
+    *encoded_len = writer.pos;
+    self->logger->info_log("Encoded", __FILE__, __LINE__);
+    return writer.out;
 }
 
 /**
- * Get the encoded data from raw encoded data string
- * @param self The Huffman tree
- * @param header_str the raw data string
- * @return the encoded data
+ * Parse an unsigned number and advance past it
+ * @param cur The parse position, moved past the digits
+ * @param end The end of the line
+ * @param base 10 or 16
+ * @param value The parsed number
+ * @return 0 on success, -1 if there are no digits or the number overflows
  */
-static const char *get_encoded_data(HuffmanTree *self, const char *encoded_str)
+static int parse_uint(const char **cur, const char *end, unsigned base,
+                      uint64_t *value)
 {
-    self->logger->info_log("Extracting encoded data", __FILE__, __LINE__);
-    int cur_idx = 0;
-    char line[ALLOC_SIZE];
-
-    while (sscanf(encoded_str + cur_idx, "%s", line) == 1) {
-        cur_idx += strlen(line) + 1;
-        if (strncmp(line, "Compression", 11) == 0) {
+    const char *start = *cur;
+    *value = 0;
+    for (; *cur < end; (*cur)++) {
+        char c = **cur;
+        unsigned digit;
+        if (c >= '0' && c <= '9')
+            digit = (unsigned)(c - '0');
+        else if (base == 16 && c >= 'a' && c <= 'f')
+            digit = (unsigned)(c - 'a' + 10);
+        else if (base == 16 && c >= 'A' && c <= 'F')
+            digit = (unsigned)(c - 'A' + 10);
+        else
             break;
-        }
+        if (*value > (UINT64_MAX - digit) / base)
+            return -1;
+        *value = *value * base + digit;
     }
+    return *cur == start ? -1 : 0;
+}
 
-    self->logger->info_log("Encoded data extracted", __FILE__, __LINE__);
-    return encoded_str + cur_idx + 16;
+/**
+ * Parse a "<label><number>" trailer line of the text header
+ * @param cur The start of the line
+ * @param end The end of the line
+ * @param label The expected label
+ * @param value The parsed number
+ * @return 0 on success, -1 if the line does not match
+ */
+static int parse_length_line(const char *cur, const char *end,
+                             const char *label, uint64_t *value)
+{
+    size_t label_len = strlen(label);
+    if ((size_t)(end - cur) < label_len || memcmp(cur, label, label_len) != 0)
+        return -1;
+    cur += label_len;
+    return parse_uint(&cur, end, 10, value) == 0 && cur == end ? 0 : -1;
 }
 
 /**
- * Encode the given data
+ * Parse the legacy text header into self->codes in a single pass
  * @param self The Huffman tree
- * @param data The data to be encoded
- * @param code_table The code table to encode the data
- * @return the encoded data
+ * @param data The encoded file
+ * @param len The length of the encoded file
+ * @param raw_len The uncompressed length recorded in the header
+ * @param bit_len The compressed length in bits recorded in the header
+ * @return the start of the encoded data, NULL if the header is malformed
  */
-static char *encode(HuffmanTree *self, const char *data,
-                    const char **code_table, const size_t raw_len)
+static const char *parse_text_header(HuffmanTree *self, const char *data,
+                                     const size_t len, uint64_t *raw_len,
+                                     uint64_t *bit_len)
 {
-    size_t ext_len = 0;
-    size_t encoded_data_len = 0;
-    char *encoded_data = must_calloc(ALLOC_SIZE, sizeof(char));
+    self->logger->info_log("Extracting header", __FILE__, __LINE__);
+    memset(self->codes, 0, sizeof(self->codes));
+    self->size = 0;
 
-    if (!encoded_data) {
-        return NULL;
-    }
+    // "<byte in hex>=<code in 0/1>" lines until the length trailer
+    const char *cur = data, *end = data + len;
+    const char *eol;
+    while ((eol = memchr(cur, '\n', (size_t)(end - cur))) != NULL) {
+        if (*cur == 'U')
+            break;
 
-    for (size_t i = 0; i < raw_len; ++i) {
-        for (size_t j = 0; j < self->size; ++j) {
-            unsigned int byte;
-            char code[ALLOC_SIZE];
-            if (sscanf(code_table[j], "%x=%s", &byte, code) != 2) {
-                // Handle invalid code table entry
-                free(encoded_data);
-                return NULL;
-            }
+        // older writers printed the byte from a signed char, so 0x80 and up
+        // appear sign-extended as ffffff80 to ffffffff
+        uint64_t byte;
+        if (self->size == SYMBOL_NUM || parse_uint(&cur, eol, 16, &byte) ||
+            (byte > 0xff && (byte < 0xffffff80 || byte > 0xffffffff)))
+            return NULL;
+        byte &= 0xff;
+        if (cur == eol || *cur++ != '=' || cur == eol || eol - cur > 64 ||
+            self->codes[byte].len)
+            return NULL;
 
-            if (data[i] == (char)byte) {
-                // Ensure there is enough space in encoded_data
-                size_t code_len = strlen(code);
-                if (encoded_data_len + code_len >= ext_len * ALLOC_SIZE) {
-                    uint8_t *temp = (uint8_t *)realloc(encoded_data,
-                                                       ALLOC_SIZE * ++ext_len);
-                    if (!temp) {
-                        free(encoded_data);
-                        return NULL;
-                    }
-                    encoded_data = (char *)temp;
-                }
-                memcpy(encoded_data + encoded_data_len, code, code_len);
-                encoded_data_len += code_len;
-                break;
-            }
+        HuffmanCode *code = &self->codes[byte];
+        code->len = (uint8_t)(eol - cur);
+        for (; cur < eol; cur++) {
+            if (*cur != '0' && *cur != '1')
+                return NULL;
+            code->bits = (code->bits << 1) | (uint64_t)(*cur == '1');
         }
+        self->size++;
+        cur = eol + 1;
     }
 
-    // Null-terminate the encoded string
-    if (encoded_data_len < ext_len * ALLOC_SIZE) {
-        encoded_data[encoded_data_len] = '\0';
-    } else {
-        // Handle rare case where encoded_data is exactly full
-        uint8_t *temp = (uint8_t *)realloc(encoded_data, encoded_data_len + 1);
-        if (!temp) {
-            free(encoded_data);
-            return NULL;
-        }
-        temp[encoded_data_len] = '\0';
-        encoded_data = (char *)temp;
-    }
-    return encoded_data;
+    // Uncompressed Length, Compressed Length, Compression Ratio
+    if (!eol ||
+        parse_length_line(cur, eol, "Uncompressed Length: ", raw_len) != 0)
+        return NULL;
+    cur = eol + 1;
+    if (!(eol = memchr(cur, '\n', (size_t)(end - cur))) ||
+        parse_length_line(cur, eol, "Compressed Length: ", bit_len) != 0)
+        return NULL;
+    cur = eol + 1;
+    if (!(eol = memchr(cur, '\n', (size_t)(end - cur))) || eol - cur < 19 ||
+        memcmp(cur, "Compression Ratio: ", 19) != 0)
+        return NULL;
+
+    self->logger->info_log("Header extracted", __FILE__, __LINE__);
+    return eol + 1;
 }
+
 /**
- * Build a Huffman tree from the given header
+ * Build a Huffman tree from the compiled code table
  * @param self The Huffman tree
- * @param header The header of the encoded file
+ * @return 0 on success, -1 if the codes are not a prefix code
  */
-static size_t build_tree_from_header(HuffmanTree *self, const char **header)
+static int build_tree_from_codes(HuffmanTree *self)
 {
     self->logger->info_log("Building tree from header", __FILE__, __LINE__);
 
-    size_t decoded_len = 0;
-    Node *cur_node = self->root = create_node('\0');
-
-    for (size_t i = 0; i < self->size; i++) {
-        unsigned int byte;
-        char code[ALLOC_SIZE];
-        sscanf(header[i], "%x=%s", &byte, code);
-
-        for (size_t j = 0; j < strlen(code); j++) {
-            if (code[j] == '0') {
-                if (!cur_node->left) {
-                    cur_node->left = create_node('\0');
-                    cur_node->left->p = cur_node;
-                }
-                cur_node = cur_node->left;
-            } else {
-                if (!cur_node->right) {
-                    cur_node->right = create_node('\0');
-                    cur_node->right->p = cur_node;
-                }
-                cur_node = cur_node->right;
+    NodeArena *arena = &self->arena;
+    reset_arena(arena);
+    self->root = create_node(arena, '\0');
+    bool leaf[MAX_NODE_NUM] = {false};
+    for (unsigned byte = 0; byte < SYMBOL_NUM; byte++) {
+        HuffmanCode code = self->codes[byte];
+        int16_t cur = 0;
+        for (unsigned j = code.len; j > 0; j--) {
+            // a code may not continue past the end of a shorter one
+            if (leaf[cur])
+                return -1;
+            Node *cur_node = &arena->nodes[cur];
+            int16_t *next = (code.bits >> (j - 1)) & 1 ? &cur_node->right
+                                                        : &cur_node->left;
+            if (*next == NO_NODE) {
+                Node *newnode = create_node(arena, '\0');
+                if (!newnode)
+                    return -1;
+                newnode->p = cur;
+                *next = (int16_t)(newnode - arena->nodes);
             }
+            cur = *next;
         }
-        cur_node->data = (char)byte;
-        cur_node = self->root;
-        decoded_len++;
+        if (code.len == 0)
+            continue;
+
+        // nor end where another code ends or passes through
+        Node *end = &arena->nodes[cur];
+        if (leaf[cur] || end->left != NO_NODE || end->right != NO_NODE)
+            return -1;
+        leaf[cur] = true;
+        end->data = (char)byte;
     }
     self->logger->info_log("Tree built from header", __FILE__, __LINE__);
-    return decoded_len;
+    return 0;
 }
 
 /**
  * Decode the given data (helper function)
  * @param self The Huffman tree
  * @param encoded_data The encoded data
+ * @param decoded_len The length of the decoded data
+ * @param bit_len The number of encoded bits
+ * @param capacity The expected length of the decoded data
  *
  * @return the decoded data
  */
 static char *_decode(const HuffmanTree *self, const char *encoded_data,
-                     size_t *decoded_len, size_t encoded_len)
+                     size_t *decoded_len, size_t bit_len, size_t capacity)
 {
     self->logger->info_log("Decoding", __FILE__, __LINE__);
     if (!self->root) {
@@ -343,17 +571,34 @@ static char *_decode(const HuffmanTree *self, const char *encoded_data,
     }
 
     // decode the data
-    Node *cur_node = self->root;
-    size_t i = 0, j = 1;
-    char *decoded_data = must_calloc(ALLOC_SIZE, sizeof(char));
-
-    while (i < encoded_len) {
-        while (cur_node->left != NULL && cur_node->right != NULL) {
-            cur_node =
-                encoded_data[i++] == '0' ? cur_node->left : cur_node->right;
+    const Node *nodes = self->arena.nodes;
+    const Node *cur_node = self->root;
+    size_t i = 0;
+    char *decoded_data = must_calloc(capacity + 1, sizeof(char));
+
+    while (i < bit_len) {
+        while ((cur_node->left != NO_NODE || cur_node->right != NO_NODE) &&
+               i < bit_len) {
+            int16_t next = get_bit(encoded_data, i++, self->text_format)
+                               ? cur_node->right
+                               : cur_node->left;
+            if (next == NO_NODE) {
+                self->logger->error_log("Invalid code", __FILE__, __LINE__);
+                free(decoded_data);
+                return NULL;
+            }
+            cur_node = &nodes[next];
+        }
+        // the stream ended inside a code, or there is no code to read
+        if (cur_node->left != NO_NODE || cur_node->right != NO_NODE ||
+            cur_node == self->root) {
+            self->logger->error_log("Truncated code", __FILE__, __LINE__);
+            free(decoded_data);
+            return NULL;
         }
-        if (*decoded_len >= ALLOC_SIZE * j) {
-            char *tmp = realloc(decoded_data, sizeof(char) * 256 * ++j);
+        if (*decoded_len >= capacity) {
+            capacity = capacity * 2 + ALLOC_SIZE;
+            char *tmp = realloc(decoded_data, sizeof(char) * capacity);
             if (!tmp) {
                 free(decoded_data);
                 return NULL;
@@ -369,49 +614,193 @@ static char *_decode(const HuffmanTree *self, const char *encoded_data,
 }
 
 /**
- * destroy header - free the header
- * @param header The header of the encoded file
+ * Fill the decode table from the canonical codes. The first LOOKUP_BITS bits
+ * of the stream index the first level, and codes longer than that continue in
+ * a second-level table indexed by the remaining bits. Only the first level
+ * and the second-level tables handed out are cleared, so a table left over
+ * from the previous block can be reused.
+ * @param codes The code table
+ * @param table The decode table, at least DECODE_TABLE_SIZE entries
  */
-static void destroy_header(const char **header)
+static void build_decode_table(const HuffmanCode codes[], DecodeEntry table[])
 {
-    for (size_t i = 0; i < ALLOC_SIZE; i++) {
-        if (header[i] == NULL)
-            break;
-        free((void *)header[i]);
+    memset(table, 0, (1 << LOOKUP_BITS) * sizeof(DecodeEntry));
+    uint16_t next_sub = 1 << LOOKUP_BITS;
+
+    for (size_t i = 0; i < SYMBOL_NUM; i++) {
+        unsigned len = codes[i].len;
+        size_t bits = (size_t)codes[i].bits;
+        DecodeEntry entry = {.next = 0, .symbol = (uint8_t)i,
+                             .len = (uint8_t)len};
+        if (len == 0)
+            continue;
+
+        // a short code owns every first-level slot it is a prefix of
+        if (len <= LOOKUP_BITS) {
+            size_t first = bits << (LOOKUP_BITS - len);
+            for (size_t j = 0; j < (size_t)1 << (LOOKUP_BITS - len); j++)
+                table[first + j] = entry;
+            continue;
+        }
+
+        DecodeEntry *prefix = &table[bits >> (len - LOOKUP_BITS)];
+        if (prefix->next == 0) {
+            prefix->next = next_sub;
+            memset(&table[next_sub], 0,
+                   (1 << SUB_LOOKUP_BITS) * sizeof(DecodeEntry));
+            next_sub += 1 << SUB_LOOKUP_BITS;
+        }
+        unsigned sub_len = len - LOOKUP_BITS;
+        size_t first = (bits & (((size_t)1 << sub_len) - 1))
+                       << (SUB_LOOKUP_BITS - sub_len);
+        for (size_t j = 0; j < (size_t)1 << (SUB_LOOKUP_BITS - sub_len); j++)
+            table[prefix->next + first + j] = entry;
     }
-    free(header);
 }
 
 /**
- * Decode the given data
+ * Top up the bit reader so that at least 57 bits are buffered. Bits past the
+ * end of the stream read as zero.
+ * @param reader The bit reader
+ */
+static inline void refill(BitReader *reader)
+{
+    while (reader->count <= 56) {
+        uint64_t byte = reader->pos < reader->len ? reader->data[reader->pos]
+                                                  : 0;
+        reader->pos++;
+        reader->acc |= byte << (56 - reader->count);
+        reader->count += 8;
+    }
+}
+
+/**
+ * Decode a canonical bit stream with the two-level lookup table
+ * @param self The Huffman tree, with canonical codes in self->codes
+ * @param encoded_data The packed bit stream
+ * @param bit_len The number of encoded bits
+ * @param out The decoded data
+ * @param raw_len The length of the decoded data
+ *
+ * @return 0 on success, -1 on an invalid code
+ */
+static int decode_canonical(HuffmanTree *self, const char *encoded_data,
+                            size_t bit_len, char *out, size_t raw_len)
+{
+    // the table is kept for the next block decoded with this tree
+    if (!self->decode_table)
+        self->decode_table =
+            must_calloc(DECODE_TABLE_SIZE, sizeof(DecodeEntry));
+    DecodeEntry *table = self->decode_table;
+    build_decode_table(self->codes, table);
+
+    BitReader reader = {.acc = 0, .count = 0, .pos = 0};
+    reader.data = (const unsigned char *)encoded_data;
+    reader.len = (bit_len + 7) / 8;
+    size_t consumed = 0;
+
+    for (size_t i = 0; i < raw_len; i++) {
+        if (reader.count < MAX_CODE_LEN)
+            refill(&reader);
+        DecodeEntry entry = table[reader.acc >> (64 - LOOKUP_BITS)];
+        if (entry.next != 0)
+            entry = table[entry.next +
+                          ((reader.acc >> (64 - MAX_CODE_LEN)) &
+                           ((1u << SUB_LOOKUP_BITS) - 1))];
+        if (entry.len == 0 || (consumed += entry.len) > bit_len) {
+            self->logger->error_log("Invalid code", __FILE__, __LINE__);
+            return -1;
+        }
+        reader.acc <<= entry.len;
+        reader.count -= entry.len;
+        out[i] = (char)entry.symbol;
+    }
+    return 0;
+}
+
+/**
+ * Decode the body of a packed block
  * @param self The Huffman tree
+ * @param block The block body: padding, code lengths and bit stream
+ * @param block_len The length of the block body
+ * @param out The decoded data, raw_len bytes long
+ * @param raw_len The length of the decoded data
  *
- * @return the decoded data
+ * @return 0 on success, -1 if the block is malformed
  */
-static char *decode(HuffmanTree *self, char *encoded_str, size_t *decoded_len,
-                    size_t encoded_len)
+static int decode_block(HuffmanTree *self, const char *block,
+                        const size_t block_len, char *out,
+                        const size_t raw_len)
 {
-    const char **header = get_header(self, encoded_str);
-    const char *encoded_data = get_encoded_data(self, encoded_str);
-    encoded_len -= (size_t)(encoded_data - encoded_str);
-    build_tree_from_header(self, header);
-    destroy_header(header);
-    return _decode(self, encoded_data, decoded_len, encoded_len);
+    const unsigned char *data = (const unsigned char *)block;
+    if (block_len == 0) {
+        self->logger->error_log("Malformed block", __FILE__, __LINE__);
+        return -1;
+    }
+    unsigned padding = data[0];
+    size_t pos = 1;
+
+    // every byte of the length table is <code length:4> <run length - 1:4>
+    memset(self->codes, 0, sizeof(self->codes));
+    size_t kraft = 0;
+    self->size = 0;
+    for (size_t symbol = 0; symbol < SYMBOL_NUM;) {
+        if (pos >= block_len) {
+            self->logger->error_log("Malformed block", __FILE__, __LINE__);
+            return -1;
+        }
+        uint8_t len = data[pos] >> 4;
+        size_t run = (data[pos++] & 0xfu) + 1;
+        for (size_t end = symbol + run; symbol < end && symbol < SYMBOL_NUM;
+             symbol++) {
+            self->codes[symbol].len = len;
+            self->size += len > 0;
+            kraft += len > 0 ? (size_t)1 << (MAX_CODE_LEN - len) : 0;
+        }
+    }
+
+    size_t bit_len = (block_len - pos) * 8;
+    if (padding > 7 || bit_len < padding ||
+        kraft > (size_t)1 << MAX_CODE_LEN || (raw_len > 0 && kraft == 0)) {
+        self->logger->error_log("Malformed block", __FILE__, __LINE__);
+        return -1;
+    }
+    assign_canonical_codes(self->codes);
+    return decode_canonical(self, block + pos, bit_len - padding, out,
+                            raw_len);
 }
 
 /**
- * Free the Huffman tree node
- * @param self The Huffman tree node
+ * Decode the given data in the legacy text format, packed containers are
+ * decoded by decompress_stream
+ * @param self The Huffman tree
+ *
+ * @return the decoded data
  */
-static void destroy_node(Node **self)
+static char *decode(HuffmanTree *self, char *encoded_str, size_t *decoded_len,
+                    size_t encoded_len)
 {
-    if (!self || !*self)
-        return;
+    self->text_format = true;
+    uint64_t raw_len, bit_len;
+    const char *encoded_data =
+        parse_text_header(self, encoded_str, encoded_len, &raw_len, &bit_len);
+    if (!encoded_data) {
+        self->logger->error_log("Malformed header", __FILE__, __LINE__);
+        return NULL;
+    }
 
-    destroy_node(&(*self)->left);
-    destroy_node(&(*self)->right);
-    free(*self);
-    *self = NULL;
+    // every code is at least one bit long, which bounds the output
+    size_t body_len = encoded_len - (size_t)(encoded_data - encoded_str);
+    if (bit_len > body_len)
+        bit_len = body_len;
+    if (raw_len > bit_len)
+        raw_len = bit_len;
+    if (build_tree_from_codes(self) != 0) {
+        self->logger->error_log("Malformed header", __FILE__, __LINE__);
+        return NULL;
+    }
+    return _decode(self, encoded_data, decoded_len, (size_t)bit_len,
+                   (size_t)raw_len);
 }
 
 /**
@@ -423,7 +812,11 @@ static void destroy(HuffmanTree **self)
     if (!self || !*self)
         return;
 
-    destroy_node(&(*self)->root);
+    // the nodes all live in the arena, so they go in one shot
+    reset_arena(&(*self)->arena);
+    (*self)->root = NULL;
+    free((*self)->decode_table);
+    (*self)->decode_table = NULL;
 }
 
 /**
@@ -435,12 +828,14 @@ HuffmanTree *new_huffman_tree(void)
     HuffmanTree *self = must_calloc(1, sizeof(HuffmanTree));
     self->root = NULL;
     self->size = 0;
+    self->text_format = false;
     self->gen_freq_arr = &gen_freq_arr;
     self->build_tree = &build_tree;
     self->cal_code_table = &cal_code_table;
     self->destroy = &destroy;
     self->encode = &encode;
     self->decode = &decode;
+    self->decode_block = &decode_block;
     init_logger(&self->logger);
     self->logger->info_log("Huffman tree initialized", __FILE__, __LINE__);
     return self;
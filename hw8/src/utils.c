@@ -1,7 +1,12 @@
+#define _POSIX_C_SOURCE 200809L
 #include "../include/utils.h"
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 void *must_calloc(size_t count, size_t nmemb)
 {
@@ -15,42 +20,64 @@ void *must_calloc(size_t count, size_t nmemb)
 
 char *read_file(const char *filename, size_t *filelen)
 {
-    FILE *file;
-    char *buffer;
-
-    file = fopen(filename, "rb");
-
-    if (file == NULL) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
         perror("Error opening file");
         exit(1);
     }
 
-    // get filename
-    fseek(file, 0, SEEK_END);
-    *filelen = (size_t)ftell(file);
-    rewind(file);
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "Error: %s is not a regular file\n", filename);
+        exit(1);
+    }
+    *filelen = (size_t)st.st_size;
 
-    // store data
-    buffer = (char *)malloc(*filelen * sizeof(char));
-    fread(buffer, *filelen, 1, file);
-    fclose(file);
+    // mmap refuses empty mappings, and there is nothing to read anyway
+    static char empty[1];
+    if (*filelen == 0) {
+        close(fd);
+        return empty;
+    }
+
+    // map the file instead of copying it, the kernel reads ahead for us
+    char *buffer = mmap(NULL, *filelen, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buffer == MAP_FAILED) {
+        perror("Error mapping file");
+        exit(1);
+    }
+    posix_madvise(buffer, *filelen, POSIX_MADV_SEQUENTIAL);
     return buffer;
 }
 
+void release_file(char *data, const size_t filelen)
+{
+    if (filelen)
+        munmap(data, filelen);
+}
+
 void write_data(const char *filename, const char *mode, const char *data,
                 const size_t data_len)
 {
     FILE *fd = fopen(filename, mode);
-    for (size_t i = 0; i < data_len; i++)
-        fputc(data[i], fd);
-    fclose(fd);
+    if (fd == NULL) {
+        perror("Error opening file");
+        exit(1);
+    }
+
+    // one large write, stdio hands it to the kernel without copying
+    if (fwrite(data, 1, data_len, fd) != data_len || fclose(fd) == EOF) {
+        perror("Error writing file");
+        exit(1);
+    }
 }
 
 void write_header(const char *filename, const char **header,
                   const size_t encoded_len, const size_t raw_len,
                   const size_t header_num)
 {
-    int header_len = 0;
+    size_t header_len = 0;
     FILE *fd = fopen(filename, "wb");
     for (size_t i = 0; i < header_num; i++) {
         fprintf(fd, "%s\n", header[i]);
@@ -59,11 +86,69 @@ void write_header(const char *filename, const char **header,
     int p_org_len = fprintf(fd, "Uncompressed Length: %zu\n", raw_len);
     int p_enc_len = fprintf(fd, "Compressed Length: %zu\n", encoded_len);
     fprintf(fd, "Compression Ratio: %f\n",
-            (double)raw_len / (double)((int)encoded_len + header_len +
-                                       p_org_len + p_enc_len + 29));
+            (double)raw_len /
+                (double)(encoded_len + header_len + (size_t)p_org_len +
+                         (size_t)p_enc_len + 29));
     fclose(fd);
 }
 
+/**
+ * put_le - Write a little-endian integer to a file.
+ * @param fd The file to write to.
+ * @param value The integer to write.
+ * @param width The number of bytes to write.
+ */
+static void put_le(FILE *fd, uint64_t value, size_t width)
+{
+    for (size_t i = 0; i < width; i++)
+        fputc((int)((value >> (8 * i)) & 0xff), fd);
+}
+
+void write_packed_magic(FILE *fd)
+{
+    fwrite(PACKED_MAGIC, 1, PACKED_MAGIC_LEN, fd);
+    fputc(PACKED_VERSION, fd);
+}
+
+size_t write_packed_block(FILE *fd, const HuffmanCode codes[],
+                          const size_t raw_len, const char *encoded,
+                          const size_t encoded_bits)
+{
+    // the codes are canonical, so runs of code lengths are all we need
+    unsigned char lens[SYMBOL_NUM];
+    size_t lens_len = 0;
+    for (size_t i = 0; i < SYMBOL_NUM;) {
+        size_t run = 1;
+        while (run < 16 && i + run < SYMBOL_NUM &&
+               codes[i + run].len == codes[i].len)
+            run++;
+        lens[lens_len++] = (unsigned char)((codes[i].len << 4) | (run - 1));
+        i += run;
+    }
+
+    size_t encoded_len = (encoded_bits + 7) / 8;
+    put_le(fd, raw_len, 4);
+    put_le(fd, 1 + lens_len + encoded_len, 4);
+    fputc((int)((8 - encoded_bits % 8) % 8), fd);
+    fwrite(lens, 1, lens_len, fd);
+    fwrite(encoded, 1, encoded_len, fd);
+    return BLOCK_HEADER_LEN + 1 + lens_len + encoded_len;
+}
+
+void write_packed_end(FILE *fd, const uint64_t offsets[],
+                      const uint64_t raw_offsets[], const size_t block_num,
+                      const size_t raw_len)
+{
+    put_le(fd, 0, 4);
+    put_le(fd, 0, 4);
+    for (size_t i = 0; i < block_num; i++) {
+        put_le(fd, offsets[i], 8);
+        put_le(fd, raw_offsets[i], 8);
+    }
+    put_le(fd, raw_len, 8);
+    put_le(fd, block_num, 8);
+}
+
 void print_header(const char **header, size_t header_num)
 {
     for (size_t i = 0; i < header_num; i++) {